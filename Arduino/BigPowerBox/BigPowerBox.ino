@@ -8,116 +8,244 @@
 
 #include "myDefines.h"
 #include "board.h"
+#include "dewpoint.h"
 #include <Arduino.h>
+#include <stddef.h>
 #include <EEPROM.h>                     // needed for EEPROM
 #include <Wire.h>
-#include <Adafruit_MCP23X17.h>
 #include <Adafruit_SHT31.h>             // for SHT3x sensor attached to RJ12 port
 #include <SparkFun_I2C_Mux_Arduino_Library.h>
 #include <Adafruit_AHTX0.h>
 #include <Adafruit_BME280.h>
-#include <PIDController.h>
+#include <util/crc16.h>
+#include <util/atomic.h>
 
 #ifdef DEBUG
 #include <MemoryFree.h>
 #endif
 
-Adafruit_MCP23X17 mcp;
+Expander<(MUXPORTS > 0)> mcp;           // only pulls in the MCP23017 driver if we have 'm' ports
 Adafruit_SHT31 sht31 = Adafruit_SHT31();
 Adafruit_BME280 bme;
 QWIICMUX imux;
 Adafruit_AHTX0 aht10;
-PIDController pid[4];   // up to 4 pid controllers, one for each PWM port
 
 int probeCount = 0;
 int memfree = 0;
 int prevmemfree = 0;
 
-const String programName = "BigPowerBox";
-const String programVersion = "013";
-const String programAuthor = "Michel Moriniaux";
+const char programName[] PROGMEM = "BigPowerBox";
+const char programVersion[] PROGMEM = "013";
+const char programAuthor[] PROGMEM = "Michel Moriniaux";
 
 struct config_t powerBoxConf;
 struct status_t powerBoxStatus;
+cal_t powerBoxCal[CALCHANNELS];           // calibration of each ADC channel, the other settings are read from EEPROM
 
-extern String boardSignature;
-extern const byte ports2Pin[];
-extern const byte port2bin[];
-
-char* queue[QUEUELENGTH];
-int queueHead = -1;
+char queue[QUEUESIZE];                    // commands back to back with their terminator, parsed in place
+int queueTop = 0;                         // end of the newest command
 int queueCount = 0;
 
 // Machine states
 enum FSMStates { stateIdle, stateRead, stateDew, stateSwap };
 // PWM port modes
 enum PWMModes { variable, switchable, dewHeater, tempFeedback};
+enum TuneStates { tuneIdle, tuneRunning, tuneDone, tuneFailed };
+enum ScopeStates { scopeIdle, scopeSettling, scopeArmed, scopeTriggered, scopeDone, scopeTimeout };
 // Commands
-String line;                              // command buffer
-String status;                            // status string buffer
+char line[MAXCOMMAND];                    // command being received, without its '>' and '#' markers
+char reply[REPLYSIZE];                    // formatted reply
 
 int currentConfAddr = 0;                  // EEPROM address of the current valid config storage block
-int portIndex = 0;                        // index of the current port being measured
-int portMax;                              // number of ports
-int idx = 0;                              // index into the command string
+byte portIndex = 0;                       // index of the current port being measured
+int idx = 0;                              // index into the command string, MAXCOMMAND once it has overflowed
 bool haveTemp;                            // stores whether the SHT sensor was found (true)
 bool havePress = false;                   // only for BME280
-bool dsel = true;                         // we start with dsel HIGH for port 1
-int chip = 0;                             // chip index being measured
 // time
 long int now;                             // now time in millis
 long int last;                            // last time in millis
-long int lastm;                           // last time we updated the dewheaters in millis
+long int lastm;                           // last time we read the temperature probes in millis
+long serialBaud = SERIALPORTSPEED;        // rate of the serial link
+bool baudPending = false;                 // the link was switched by a b command and waits for a ping
+unsigned long baudStamp;                  // millis() of the switch
+bool configDirty = false;                 // the config changed but has not been written to EEPROM yet
+
+// fast protection, shared with the ADC interrupt
+const byte adcPins[ADCCHANNELS] = { VSIN, ISIN, ISOUT };
+volatile unsigned int adcRaw[ADCCHANNELS];      // latest raw reading of each channel
+volatile unsigned int tripLevel[ADCCHANNELS];   // raw reading at which each channel trips
+volatile bool tripArmed[ADCCHANNELS];           // a channel re-arms once it reads below its trip level
+volatile byte adcChannel = 0;                   // channel being converted
+volatile byte adcCycles = 0;                    // counts the passes through all channels
+volatile byte sensePort = 0;                    // port selected on the current sense
+volatile byte senseSettle = 0;                  // passes left before the port current sense is trusted
+volatile byte tripPending = 0;                  // bitmap of the channels with a trip waiting for the loop to finish it
+volatile unsigned int tripPorts = 0;            // bitmap of the ports cut by a port trip not finished yet
+volatile byte tripPort;                         // first of them, the one tripRaw[ADCIOUT] belongs to
+volatile unsigned int tripRaw[ADCCHANNELS];     // reading of the first unfinished trip of each channel
+volatile unsigned long tripMicros[ADCCHANNELS];
+unsigned int portTrip[PORTNUM];                 // raw ISOUT trip level of each port
+fault_t faultLog[FAULTLOGSIZE];                 // ring of the last faults
+unsigned int faultCount = 0;                    // number of faults since boot, the next one goes to faultCount % FAULTLOGSIZE
+unsigned long faultWorst = 0;                   // longest latency logged since boot in us
+long fuseHeat[PORTNUM];                         // I2t accumulated above the rated current of each port in A2ms
+unsigned int fuseStamp[PORTNUM];                // millis() of the last I2t update of each port, only the difference matters
+unsigned int fuseBlown = 0;                     // bitmap of the ports cut by their fuse, cleared when the port is turned back on
+// power-on sequencer
+unsigned int seqPending = 0;                    // bitmap of the ports waiting to be turned on
+byte seqLevel[PORTNUM];                         // level each pending port is turned on to
+unsigned long seqStamp = 0;                     // millis() when the last port was turned on
+unsigned int seqWait = 0;                       // wait of the last port turned on
+long seqPeak = 0;                               // peak input current seen during the last sequence in mA
+// load shedding
+long filteredAmps = 0;                          // filtered input current in mA
+unsigned int shedPorts = 0;                     // bitmap of the ports switched off to stay within the budget
+byte shedThrottle = 0;                          // dew heaters run at (SHEDSTEPS - shedThrottle) / SHEDSTEPS of their level
+// PWM engine
+byte pwmOut[PWMPORTS];                          // level last written to each PWM output
+volatile unsigned int rippleCount = 0;          // input current samples taken in the current ripple window
+volatile unsigned long rippleSum = 0;           // sum of the raw samples of the window
+volatile unsigned long rippleSquares = 0;       // sum of their squares
+volatile unsigned int rippleMin = NOTRIP;       // raw extremes of the window
+volatile unsigned int rippleMax = 0;
+long ripplePeak = 0;                            // peak input current in mA over the last window
+// scope capture, shared with the ADC interrupt
+byte scopeBuffer[SCOPESIZE];                    // frames of 8 bit samples, a ring until the capture is done
+volatile byte scopeState = scopeIdle;           // enum ScopeStates
+byte scopePort;                                 // port captured
+byte scopeChannels;                             // bitmap of the ADC channels recorded, ADCIOUT always is
+byte scopeFrame;                                // samples per frame
+unsigned int scopeDepth;                        // samples in the buffer, a whole number of frames
+unsigned int scopeWrite;                        // next sample to write, the oldest one once the buffer has wrapped
+unsigned long scopeFrames;                      // frames recorded since armed
+unsigned int scopePre;                          // frames kept before the trigger
+unsigned int scopePost;                         // frames left to record from the trigger on
+unsigned int scopeLevel;                        // raw ISOUT trigger level
+byte scopeDecimate;                             // one pass out of scopeDecimate is recorded
+byte scopeSkip;                                 // passes before the next recorded one
+unsigned long scopeTime;                        // micros() when armed, the recording time in us once done
+unsigned long scopeStamp;                       // millis() at the start of the capture
+long rippleRms = 0;                             // RMS input current in mA over the last window
+unsigned long shedStamp = 0;                    // millis() of the last shedding or restore step
+byte dewLevel[PWMPORTS];                        // level asked by the dew control for each PWM port, before throttling
+// dew heater control
+float dewIntegral[PWMPORTS];                    // PID integral term of each PWM port, in PWM levels
+float dewError[PWMPORTS];                       // last control error of each PWM port in C, target - temperature
+unsigned long dewStamp[PWMPORTS];               // millis() of the last control step of each PWM port, 0 before the first
+// PID auto-tune, one PWM port at a time
+byte tuneState = tuneIdle;                      // enum TuneStates
+byte tunePort;                                  // PWM port being tuned
+byte tuneCycle;                                 // oscillation cycles seen so far
+bool tuneHigh;                                  // relay output is on
+float tuneTarget;                               // relay setpoint in C
+float tuneMax, tuneMin;                         // probe temperature extremes of the current cycle
+float tunePeriods, tuneAmplitudes;              // sums over the measured cycles, in s and C
+unsigned long tuneStart;                        // millis() at start
+unsigned long tuneSwitch;                       // millis() of the last relay switch off, 0 before the first
+long filteredVolts = 0;                         // filtered input voltage in mV
+bool lowVoltage = false;                        // the low voltage disconnect is holding the shed ports
+// battery state of charge
+long batteryCharge = -1;                        // charge left in CHARGEUNIT, -1 until estimated
+long chargeCarry = 0;                           // integrated mA.ms not yet counted in the charge
+long chargeBlend = 0;                           // pull towards the rest voltage estimate not yet applied, in CHARGEUNIT * SOCBLEND
+unsigned long chargeStamp = 0;                  // millis() of the last charge update
+int batterySoc = -1;                            // state of charge in %, -1 without a battery capacity
+// telemetry history ring, read with the h command
+byte histRing[HISTORYSIZE];                     // records oldest first from histHead, wrapping around
+unsigned int histHead = 0;                      // offset of the oldest record
+unsigned int histUsed = 0;                      // bytes of records in the ring
+unsigned int histCount = 0;                     // records in the ring
+int16_t histBase[HISTFIELDS];                   // values before the oldest record, records evicted from the ring are folded into it
+byte histPortSkip = 0;                          // records left before the next one samples the ports
+unsigned long histStamp = 0;                    // millis() of the newest record
+// loop timing, always on, read and cleared with the t command
+timing_t stateTiming[stateSwap + 1];            // time spent in each FSM state
+timing_t probeTiming;                           // time spent reading a probe, all probes together
+timing_t commandTiming;                         // time spent processing a command, all commands together
+#ifdef TIMINGDETAIL
+const char timedCommands[] PROGMEM = "PDdSNMOFWCGTHKLYIJQRUVABXZfgwbEthc";
+#define TIMECOMMANDS        sizeof(timedCommands)   // one slot per command letter and a last one for unknown commands
+timing_t probeDetail[MAXPROBES];                // time spent reading each probe
+timing_t commandDetail[TIMECOMMANDS];           // time spent processing each command
+#endif
+unsigned long loopStamp = 0;                    // micros() at the start of the last loop()
+unsigned long loopGap = 0;                      // longest time between two loop() starts in us
 
 //-----------------------------------------------------------------------
 // Utility functions
 //-----------------------------------------------------------------------
 
+// the newest command, its space is only reused by the next push once it has been processed
 char* pop() {
   --queueCount;
+  // back from its terminator to the one of the command before it
+  queueTop--;
+  while ( queueTop > 0 && queue[queueTop - 1] != '\0' )
+    queueTop--;
   DPRINT(F("- pop queueCount="));
   DPRINT(queueCount);
   DPRINT(F(" content="));
-  DPRINTLN(queue[queueHead]);
-  return queue[queueHead--];
+  DPRINTLN(queue + queueTop);
+  return queue + queueTop;
 }
 
 
-void push(char command[MAXCOMMAND]) {
+// a full queue refuses the new command, the host sent faster than the loop runs
+// most commands are a few characters so QUEUELENGTH of them fit in far less than QUEUELENGTH * MAXCOMMAND bytes
+bool push(const char *command) {
+  int length = strlen(command) + 1;
+
+  if ( queueCount >= QUEUELENGTH || queueTop + length > QUEUESIZE ) {
+    DPRINTLN(F("- push queue full"));
+    return false;
+  }
   queueCount++;
-  queueHead++;
   DPRINT(F("- push queueCount="));
   DPRINT(queueCount);
   DPRINT(F(" content="));
-  strncpy(queue[queueHead], command, MAXCOMMAND);
-  DPRINTLN(queue[queueHead]);
+  memcpy(queue + queueTop, command, length);
+  DPRINTLN(queue + queueTop);
+  queueTop += length;
+  return true;
+}
+
+
+// answer a command that is not run with its letter followed by ERR, so the host does not wait for a timeout
+void refuseCommand(char letter) {
+  serialRoom(6);
+  Serial.print('>');
+  Serial.print(letter);
+  Serial.print(F("ERR#"));
 }
 
 
 // check whether to write EEPROM if contents of config are different
 //   than what is in the EEPROM at currentConfAddr
-// return true if any member is different
+// return true if any member is different, the whole struct is compared so a new member can not be missed
 bool updateEEPROMCheck( config_t savedConfig ) {
-  if ( savedConfig.portStatus != powerBoxConf.portStatus )
+  if ( memcmp(&savedConfig, &powerBoxConf, sizeof(config_t)) != 0 )
     return true;
-  for ( int i=0; i < sizeof(powerBoxConf.pwmPorts); i++ ) {
-    if ( savedConfig.pwmPorts[i] != powerBoxConf.pwmPorts[i] )
-      return true;
-    if ( savedConfig.pwmPortMode[i] != powerBoxConf.pwmPortMode[i] )
-      return true;
-    if ( savedConfig.pwmPortPreset[i] != powerBoxConf.pwmPortPreset[i] )
-      return true;
-    if ( savedConfig.pwmPortTempOffset[i] != powerBoxConf.pwmPortTempOffset[i] )
-      return true;
-  }
   DPRINTLN(F("- updateEEPROMCheck False"));
   return false;
 }
 
 
+// write a block to the EEPROM, only the bytes that changed, each byte takes 3.3ms so the faults are serviced in between
+void updateEEPROM(int address, const void *data, size_t length) {
+  const byte *bytes = (const byte *)data;
+
+  for ( size_t i = 0; i < length; i++ ) {
+    EEPROM.update(address + i, bytes[i]);
+    serviceFault();
+  }
+}
+
+
 // Write to the EEPROM if the config has changed
+// a copy is written, a fault serviced during the write changes the config and marks it dirty again
 void writeConfigToEEPROM() {
   config_t savedConfig;
+  config_t conf = powerBoxConf;
   EEPROM.get(currentConfAddr, savedConfig);
 
   if ( updateEEPROMCheck( savedConfig ) ) {
@@ -127,18 +255,80 @@ void writeConfigToEEPROM() {
     // calculate the new config slot addr
     currentConfAddr = currentConfAddr + sizeof(config_t);
     // check if the new config is going to fit, if not restart at the begining
-    if ( currentConfAddr + sizeof(config_t) >= EEPROM.length() ) {
+    if ( currentConfAddr + sizeof(config_t) > EEPROMSETBASE ) {
       currentConfAddr = EEPROMCONFBASE;
     }
     DPRINTLN(currentConfAddr);
     // write the new config at the next memory slot
-    EEPROM.put(currentConfAddr, powerBoxConf);
+    updateEEPROM(currentConfAddr, &conf, sizeof(config_t));
   }
 }
 
 
+// the settings live in EEPROM and are read where they are used, a byte reads in a few cycles
+// only the calibration is kept in SRAM, the ADC conversions and the trip levels need it at every pass
+#define SETTINGADDR(member) (EEPROMSETBASE + offsetof(settings_t, member))
+
+long getParam(byte id) {
+  long value;
+
+  EEPROM.get(SETTINGADDR(param) + id * sizeof(long), value);
+  return value;
+}
+
+
+void putParam(byte id, long value) {
+  updateEEPROM(SETTINGADDR(param) + id * sizeof(long), &value, sizeof(value));
+}
+
+
+fuse_t getFuse(byte port) {
+  fuse_t fuse;
+
+  EEPROM.get(SETTINGADDR(fuse) + port * sizeof(fuse_t), fuse);
+  return fuse;
+}
+
+
+void putFuse(byte port, const fuse_t &fuse) {
+  updateEEPROM(SETTINGADDR(fuse) + port * sizeof(fuse_t), &fuse, sizeof(fuse_t));
+}
+
+
+sequence_t getSequence(byte port) {
+  sequence_t sequence;
+
+  EEPROM.get(SETTINGADDR(sequence) + port * sizeof(sequence_t), sequence);
+  return sequence;
+}
+
+
+void putSequence(byte port, const sequence_t &sequence) {
+  updateEEPROM(SETTINGADDR(sequence) + port * sizeof(sequence_t), &sequence, sizeof(sequence_t));
+}
+
+
+dew_t getDew(byte index) {
+  dew_t dew;
+
+  EEPROM.get(SETTINGADDR(dew) + index * sizeof(dew_t), dew);
+  return dew;
+}
+
+
+void putDew(byte index, const dew_t &dew) {
+  updateEEPROM(SETTINGADDR(dew) + index * sizeof(dew_t), &dew, sizeof(dew_t));
+}
+
+
+// write the calibration of a channel from SRAM
+void putCalibration(byte channel) {
+  updateEEPROM(SETTINGADDR(cal) + channel * sizeof(cal_t), &powerBoxCal[channel], sizeof(cal_t));
+}
+
+
 // Write the new port name to the EEPROM
-void writeNameToEEPROM(int port, const String &name) {
+void writeNameToEEPROM(int port, const char *name) {
   int address;
   char buf[NAMELENGTH];
   char old[NAMELENGTH];
@@ -150,12 +340,13 @@ void writeNameToEEPROM(int port, const String &name) {
   DPRINT(F("- writeNameToEEPROM Old="));
   DPRINT(old);
   DPRINT(F(" New="));
-  name.toCharArray(buf, NAMELENGTH);
+  strncpy(buf, name, NAMELENGTH - 1);
+  buf[NAMELENGTH - 1] = '\0';
   DPRINTLN(buf);
   if (strcmp(old, buf)) {
     DPRINT(F("- writeNameToEEPROM writing="));
     DPRINTLN(buf);
-    EEPROM.put(address, buf);
+    updateEEPROM(address, buf, NAMELENGTH);
   }
 }
 
@@ -164,13 +355,18 @@ void writeNameToEEPROM(int port, const String &name) {
 // only called if we did not find a current config
 void setDefaults() {
   powerBoxConf.currentData = CURRENTCONFIGFLAG;
+  powerBoxConf.version = CONFIGVERSION;
   powerBoxConf.portStatus = ALLOFF;
-  for ( int i=0; i < sizeof(powerBoxConf.pwmPorts); i++ ) {
+  for ( int i=0; i < PWMPORTS; i++ ) {
     powerBoxConf.pwmPorts[i] = PWMMIN;
     powerBoxConf.pwmPortMode[i] = variable;
     powerBoxConf.pwmPortPreset[i] = PWMMIN;
     powerBoxConf.pwmPortTempOffset[i] = 0;
   }
+  for ( int i=0; i < PWMTIMERS; i++ )
+    powerBoxConf.pwmClock[i] = 0;
+  powerBoxConf.pwmBits = PWMBITS;
+  powerBoxConf.pwmFine = 0;
   currentConfAddr = EEPROMCONFBASE;
   writeConfigToEEPROM();                                   // update values in EEPROM
 }
@@ -182,315 +378,1662 @@ void clearSerialPort() {
 }
 
 
+// rates the host may ask for with the b command, 250000 is exact on a 16MHz clock
+bool validBaud(long baud) {
+  return baud == 9600 || baud == 19200 || baud == 38400 || baud == 57600 || baud == 115200 || baud == 250000;
+}
+
+
+// move the link to another rate once the reply sent at the old rate has left
+void switchBaud(long baud) {
+  Serial.flush();
+  Serial.end();
+  Serial.begin(baud);
+  clearSerialPort();
+  idx = 0;
+  serialBaud = baud;
+}
+
+
+// a switched link falls back to SERIALPORTSPEED unless the host pings within BAUDVERIFY
+void checkBaud() {
+  if ( baudPending && millis() - baudStamp > BAUDVERIFY ) {
+    baudPending = false;
+    switchBaud(SERIALPORTSPEED);
+  }
+}
+
+
 // SerialEvent occurs whenever new data comes in the serial RX.
 void serialEvent() {
 
   // '>' starts the command, '#' ends the command, do not store these in the command buffer
   // read the command until the terminating # character
-  char buf[MAXCOMMAND];
   while ( Serial.available() )
   {
     char inChar = Serial.read();
     switch ( inChar )
     {
       case '>':     // soc, reinit line
-        // memset(line, 0, MAXCOMMAND);
-        line = "";
         idx = 0;
         break;
       case '#':     // eoc
-        // line[idx] = '\0';
-        line.toCharArray(buf, MAXCOMMAND);
+        // a command longer than the buffer is refused rather than run truncated
+        if ( idx >= MAXCOMMAND ) {
+          idx = 0;
+          DPRINTLN(F("- serialEvent overflow"));
+          refuseCommand(line[0]);
+          break;
+        }
+        line[idx] = '\0';
         idx = 0;
         DPRINT(F("- serialEvent push="));
-        DPRINT(buf);
+        DPRINT(line);
         DPRINTLN(F("|"));
-        push(buf);
+        if ( !push(line) )
+          refuseCommand(line[0]);
         break;
       default:      // anything else
-        if ( idx < MAXCOMMAND - 1) {
-          // line[idx++] = inChar;
-          line += inChar;
-          // DPRINTLN(line);
-        }
+        if ( idx < MAXCOMMAND - 1)
+          line[idx++] = inChar;
+        else
+          idx = MAXCOMMAND;
         break;
     }
   }
 }
 
 
-// SERIAL COMMS
-void sendPacket(const String &str) {
-  DPRINT(F("- Send: "));
-  DPRINTLN(str);
-  Serial.print(str);
+// parse the colon separated integer field at pos and move pos to the next field, a missing field reads 0
+long nextField(const char *&pos) {
+  const char *end = strchr(pos, ':');
+  long value = atol(pos);
+
+  pos = end ? end + 1 : pos + strlen(pos);
+  return value;
+}
+
+
+// print a milli-unit value as a decimal with 2 digits, eg. 12345 -> "12.35"
+void printMilli(long milli) {
+  serialRoom(12);
+  if ( milli < 0 ) {
+    Serial.print('-');
+    milli = -milli;
+  }
+  milli = (milli + 5) / 10;
+  Serial.print(milli / 100);
+  Serial.print('.');
+  if ( milli % 100 < 10 )
+    Serial.print('0');
+  Serial.print(milli % 100);
+}
+
+
+// print a colon then a probe reading with 2 decimals
+void printValue(float value) {
+  serialRoom(12);
+  Serial.print(':');
+  Serial.print(value);
+}
+
+
+#ifdef BENCHMARK
+// measure the cost of converting one sample of each of the 3 ADC channels
+// with the former float math and with the fixed point calibration
+void benchmarkSampling() {
+  const int runs = 1000;
+  volatile unsigned int raw = 512;
+  volatile float f;
+  volatile long m;
+  unsigned long start;
+  unsigned long floatTime;
+  unsigned long fixedTime;
+
+  start = micros();
+  for ( int i=0; i < runs; i++) {
+    f = (( raw * (VCC / 1023.0) ) * RDIVIN ) / RDIVOUT;
+    f = (( raw * (VCC / 1023.0) ) - (VCC/2)) * 1000.0 / KINIS;
+    f = ( raw * (VCC / 1023.0) ) * KILIS / ROUTIS;
+  }
+  floatTime = micros() - start;
+  start = micros();
+  for ( int i=0; i < runs; i++) {
+    m = applyCal(powerBoxCal[CALINVOLTS], raw);
+    m = applyCal(powerBoxCal[CALINAMPS], raw);
+    m = applyCal(powerBoxCal[0], raw);
+  }
+  fixedTime = micros() - start;
+  Serial.print(F("sample cycles float="));
+  Serial.print(floatTime * clockCyclesPerMicrosecond() / runs);
+  Serial.print(F(" fixed="));
+  Serial.println(fixedTime * clockCyclesPerMicrosecond() / runs);
+}
+#endif
+
+
+// SERIAL COMMS
+// CRC-16 of everything the dump reports besides the signature, lets a driver tell whether the layout it built
+// from an earlier dump is still valid without asking for the dump again
+unsigned int configHash() {
+  unsigned int crc = 0xFFFF;
+
+  for ( int i = 0; i < PORTNUM * NAMELENGTH; i++ )
+    crc = _crc_ccitt_update(crc, EEPROM.read(EEPROMNAMEBASE + i));
+  for ( byte i = 0; i < PWMPORTS; i++ ) {
+    crc = _crc_ccitt_update(crc, powerBoxConf.pwmPortMode[i]);
+    crc = _crc_ccitt_update(crc, powerBoxConf.pwmPortTempOffset[i]);
+    crc = _crc_ccitt_update(crc, powerBoxConf.pwmPortPreset[i]);
+  }
+  for ( int i = 0; i < probeCount; i++ ) {
+    crc = _crc_ccitt_update(crc, powerBoxStatus.tempProbeType[i]);
+    crc = _crc_ccitt_update(crc, powerBoxStatus.tempProbePort[i]);
+  }
+  return crc;
+}
+
+
+// '>D:<name>:<version>:<signature>:<config hash>#', the reply to the D command and the banner sent once setup() is done
+void sendDescription() {
+  snprintf_P(reply, REPLYSIZE, PSTR(">D:%S:%S:%s:%04X#"), programName, programVersion, boardSignature.c_str(), configHash());
+  sendPacket(reply);
+}
+
+
+// '>d:<signature>:<name of each port>:<mode>:<temp offset>:<preset> of each PWM port:<type>:<mux port> of each probe#'
+// the counts follow the signature, the whole configuration is longer than any buffer we can spare so it is streamed
+void sendDump() {
+  char name[NAMELENGTH];
+  byte mode;
+
+  DPRINTLN(F("- Send: dump"));
+  sendPacket(F(">d:"));
+  sendPacket(boardSignature);
+  for ( byte i = 0; i < PORTNUM; i++ ) {
+    EEPROM.get(i * NAMELENGTH, name);
+    name[NAMELENGTH - 1] = '\0';
+    serialRoom(NAMELENGTH);
+    Serial.print(':');
+    Serial.print(name);
+  }
+  for ( byte i = 0; i < PWMPORTS; i++ ) {
+    mode = powerBoxConf.pwmPortMode[i];
+    serialRoom(12);
+    Serial.print(':');
+    Serial.print(mode > tempFeedback ? byte(variable) : mode);
+    Serial.print(':');
+    Serial.print(powerBoxConf.pwmPortTempOffset[i]);
+    Serial.print(':');
+    Serial.print(powerBoxConf.pwmPortPreset[i]);
+  }
+  for ( int i = 0; i < probeCount; i++ ) {
+    serialRoom(8);
+    Serial.print(':');
+    Serial.print(powerBoxStatus.tempProbeType[i]);
+    Serial.print(':');
+    Serial.print(powerBoxStatus.tempProbePort[i]);
+  }
+  Serial.print('#');
+}
+
+
+// wait for room for length bytes in the serial transmit buffer, servicing the faults meanwhile,
+// so a reply longer than the buffer does not hold the cut of the MCP23017 ports while it goes out
+void serialRoom(byte length) {
+  while ( Serial.availableForWrite() < length )
+    serviceFault();
+}
+
+
+void sendPacket(const char *str) {
+  DPRINT(F("- Send: "));
+  DPRINTLN(str);
+  while ( *str != '\0' ) {
+    serialRoom(1);
+    Serial.write(*str++);
+  }
+}
+
+
+void sendPacket(const __FlashStringHelper *str) {
+  const char *p = (const char *)str;
+  char c;
+
+  DPRINT(F("- Send: "));
+  DPRINTLN(str);
+  while ( (c = pgm_read_byte(p++)) != '\0' ) {
+    serialRoom(1);
+    Serial.write(c);
+  }
+}
+
+
+void sendPacket(const String &str) {
+  sendPacket(str.c_str());
+}
+
+
+//-----------------------------------------------------------------------
+// Port Operations
+//-----------------------------------------------------------------------
+void sendStatus() {
+  // send a status line to the driver with the following info:
+  // - a bitmap of port statuses following the boardSignature format
+  // the current of each port
+  // the in current
+  // the in voltage
+  // current temperature
+  // current humidity
+  // 0:0:0:0:0:0:0:0:127:255:195:100:1:1:5.54:5.49:5.42:5.37:5.44:5.49:5.54:5.49:5.39:5.49:5.44:5.37:0.22:0.23:0.07:3.37:0.00:0.00
+  // the port fields follow the order and kinds of boardPorts[]
+  // each field is written as it is formatted, the line is never held in SRAM
+
+  // port status: on/off for switchable ports, duty cycle for PWM ports, always 1 for always-on ports
+  // a shed port is reported off although the config keeps it on
+  DPRINTLN(F("- Send: status"));
+  serialRoom(3);
+  Serial.print(F(">S:"));
+  for ( byte i=0; i < PORTNUM; i++) {
+    serialRoom(4);
+    switch ( portKind(i) ) {
+      case 's':
+      case 'm':
+        Serial.print(bitRead(shedPorts, i) ? 0 : bitRead(powerBoxConf.portStatus, i));
+        break;
+      case 'p':
+        Serial.print(bitRead(shedPorts, i) ? PWMMIN : powerBoxConf.pwmPorts[i - FIRSTPWM]);
+        break;
+      case 'a':
+        Serial.print(1);
+        break;
+    }
+    Serial.print(':');
+  }
+  // port currents
+  for ( byte i=0; i < PORTNUM; i++) {
+    printMilli(powerBoxStatus.portAmps[i]);
+    Serial.print(':');
+  }
+  // input Amps
+  printMilli(powerBoxStatus.inputAmps);
+  Serial.print(':');
+  // input Volts
+  printMilli(powerBoxStatus.inputVolts);
+  // Temperatures
+  if (haveTemp) {
+    // temperature
+    printValue(powerBoxStatus.temp);
+    // humidity
+    printValue(powerBoxStatus.humid);
+    // dewpoint
+    printValue(powerBoxStatus.dewpoint);
+    // pressure
+    if (havePress)
+      printValue(powerBoxStatus.pressure);
+    for ( int i = 1; i < probeCount ; i++ ) {
+      // temperature
+      printValue(powerBoxStatus.tempProbe[i]);
+    }
+  }
+  Serial.print('#');
+}
+
+
+// drive the output of a port: level is the duty cycle for PWM ports and
+// LOW/HIGH for switchable ports, always-on ports have no output
+void writePort(byte port, byte level) {
+  switch ( portKind(port) ) {
+    case 's':
+      digitalWrite(portPin(port), level ? HIGH : LOW);
+      break;
+    case 'm':
+      mcp.digitalWrite(portPin(port), level ? HIGH : LOW);
+      break;
+    case 'p':
+      pwmOut[port - FIRSTPWM] = level;
+      pwmWrite(portPin(port), level);
+      break;
+  }
+}
+
+
+//-----------------------------------------------------------------------
+// PWM engine
+//-----------------------------------------------------------------------
+// the PWM ports sit on three timers: D5 and D6 on Timer0 (which also runs millis()), D9 on Timer1
+// and D3 on Timer2. analogWrite() leaves the ports with aligned rising edges, the pulses of ports at
+// similar duty all overlap and the input current ripple is the sum of the heaters.
+// Staggered, Timer1 and Timer2 run the same 8 bit fast PWM as Timer0 (976Hz) half a period behind it,
+// and D6 and D9 use the inverting output so their pulse ends where the period (or the half) ends:
+// D5 starts the period, D9 ends at the middle, D3 starts at the middle and D6 ends the period.
+// Up to 25% duty the pulses never overlap, above it they only overlap pairwise.
+// A timer given a clock of its own by the f command leaves the staggering and runs fast PWM at that
+// clock, Timer1 then counts up to the top of its resolution (up to 16 bit) for fine steps on D9.
+void setupPwm() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // halt the timers so they restart in step
+    GTCCR = bit(TSM) | bit(PSRASY) | bit(PSRSYNC);
+    // keep the outputs connected, drop the inverting bits
+    TCCR0A &= ~(bit(COM0A0) | bit(COM0B0));
+    TCCR1A &= bit(COM1A1) | bit(COM1B1);
+    TCCR2A &= bit(COM2A1) | bit(COM2B1);
+    // only the clock select bits, whatever the EEPROM held
+    if ( powerBoxConf.pwmClock[PWMTIMER1] ) {
+      TCCR1A |= bit(WGM11);
+      TCCR1B = bit(WGM13) | bit(WGM12) | (powerBoxConf.pwmClock[PWMTIMER1] & 0x07);
+      ICR1 = timerTop(PWMTIMER1);
+    } else if ( getParam(PARAMPWMPHASE) ) {
+      TCCR1A |= bit(WGM10);
+      TCCR1B = bit(WGM12) | bit(CS11) | bit(CS10);
+      TCNT1 = (TCNT0 + 128) & 0xFF;
+    } else {
+      // back to the phase correct 490Hz of the Arduino core
+      TCCR1A |= bit(WGM10);
+      TCCR1B = bit(CS11) | bit(CS10);
+    }
+    if ( powerBoxConf.pwmClock[PWMTIMER2] ) {
+      TCCR2A |= bit(WGM21) | bit(WGM20);
+      TCCR2B = powerBoxConf.pwmClock[PWMTIMER2] & 0x07;
+    } else if ( getParam(PARAMPWMPHASE) ) {
+      TCCR2A |= bit(WGM21) | bit(WGM20);
+      TCCR2B = bit(CS22);
+      TCNT2 = TCNT0 + 128;
+    } else {
+      TCCR2A |= bit(WGM20);
+      TCCR2B = bit(CS22);
+    }
+    GTCCR = 0;
+  }
+  // the inverted outputs need their levels written again
+  for ( byte i=0; i < PWMPORTS; i++)
+    pwmWrite(portPin(FIRSTPWM + i), pwmOut[i]);
+}
+
+
+// analogWrite() with the staggered phases and the Timer1 resolution, 0 and 255 still go through
+// digitalWrite() which disconnects the timer like the fast protection cut does
+void pwmWrite(byte pin, byte level) {
+  bool staggered = getParam(PARAMPWMPHASE);
+
+  if ( level == 0 || level == 255 ) {
+    analogWrite(pin, level);
+    return;
+  }
+  switch ( pin ) {
+    case 5:
+      if ( staggered ) {
+        OCR0B = level;
+        TCCR0A |= bit(COM0B1);
+        return;
+      }
+      break;
+    case 6:
+      if ( staggered ) {
+        OCR0A = 255 - level;
+        TCCR0A |= bit(COM0A1) | bit(COM0A0);
+        return;
+      }
+      break;
+    case 9:
+      if ( powerBoxConf.pwmClock[PWMTIMER1] ) {
+        OCR1A = fineLevel(level);
+        TCCR1A |= bit(COM1A1);
+        return;
+      }
+      if ( staggered ) {
+        OCR1A = 255 - level;
+        TCCR1A |= bit(COM1A1) | bit(COM1A0);
+        return;
+      }
+      break;
+    case 3:
+      if ( staggered && !powerBoxConf.pwmClock[PWMTIMER2] ) {
+        OCR2B = level;
+        TCCR2A |= bit(COM2B1);
+        return;
+      }
+      break;
+  }
+  analogWrite(pin, level);
+}
+
+
+// counter top of a PWM timer: 255 for 8 bit fast PWM, the Timer1 resolution when its clock is set
+unsigned int timerTop(byte timer) {
+  if ( timer == PWMTIMER1 && powerBoxConf.pwmClock[PWMTIMER1] )
+    return (1UL << constrain(powerBoxConf.pwmBits, 8, 16)) - 1;
+  return 255;
+}
+
+
+// 8 bit level of the Timer1 port matching its fine level, only 0 when the fine level is 0
+byte coarseLevel(unsigned int fine) {
+  return fine == 0 ? 0 : max(1UL, (unsigned long)fine * 255 / timerTop(PWMTIMER1));
+}
+
+
+// Timer1 compare value for an 8 bit level: the fine level set by the w command while the
+// port is still driven at its matching level, so it survives the sequencer and a restore
+unsigned int fineLevel(byte level) {
+  if ( coarseLevel(powerBoxConf.pwmFine) == level )
+    return powerBoxConf.pwmFine;
+  return (unsigned long)level * timerTop(PWMTIMER1) / 255;
+}
+
+
+// PWM frequency of a timer in Hz
+long timerHertz(byte timer) {
+  static const int timer2Prescale[] PROGMEM = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+  static const int timer1Prescale[] PROGMEM = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  byte clock = powerBoxConf.pwmClock[timer] & 0x07;
+
+  if ( clock == 0 )
+    return getParam(PARAMPWMPHASE) ? F_CPU / 64 / 256 : F_CPU / 64 / 510;
+  long prescale = (int)pgm_read_word(timer == PWMTIMER2 ? &timer2Prescale[clock] : &timer1Prescale[clock]);
+  if ( prescale == 0 )
+    return 0;
+  return F_CPU / prescale / (timerTop(timer) + 1UL);
+}
+
+
+// turn a full window of input current samples into the peak and RMS input current and start the next window
+// the RMS is taken from the mean and the variance of the raw samples, which keeps the float math away from
+// the large offset of the input current sensor
+void updateRipple() {
+  unsigned long sum, squares;
+  unsigned int low, high;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if ( rippleCount < RIPPLESAMPLES )
+      return;
+    sum = rippleSum;
+    squares = rippleSquares;
+    low = rippleMin;
+    high = rippleMax;
+    rippleSum = rippleSquares = 0;
+    rippleMin = NOTRIP;
+    rippleMax = 0;
+    rippleCount = 0;
+  }
+  const cal_t &cal = powerBoxCal[CALINAMPS];
+  float gain = cal.gain / float(1L << CALSHIFT);
+  float mean = sum / float(RIPPLESAMPLES);
+  float variance = max(squares / float(RIPPLESAMPLES) - mean * mean, 0.0F);
+  float meanAmps = gain * mean + cal.offset;
+
+  rippleRms = fixRound(sqrt(gain * gain * variance + meanAmps * meanAmps));
+  ripplePeak = max(abs(applyCal(cal, low)), abs(applyCal(cal, high)));
+}
+
+
+// put every output back in the state stored in the config, the ports that are on go through the sequencer
+// they are all handed over before it runs, so the first one up is the highest priority and not the lowest index
+void restorePorts() {
+  seqPeak = 0;
+  for ( byte i=0; i < PORTNUM; i++) {
+    if ( portKind(i) == 's' || portKind(i) == 'm' ) {
+      writePort(i, LOW);
+      seqLevel[i] = HIGH;
+      if ( bitRead(powerBoxConf.portStatus, i) )
+        bitSet(seqPending, i);
+    }
+    if ( portKind(i) == 'p' ) {
+      writePort(i, PWMMIN);
+      seqLevel[i] = powerBoxConf.pwmPorts[i - FIRSTPWM];
+      if ( seqLevel[i] > PWMMIN )
+        bitSet(seqPending, i);
+    }
+  }
+  runSequencer();
+}
+
+
+// set a port to a level and record it in the config, does not write the EEPROM
+void setPort(byte port, byte level) {
+  switch ( portKind(port) ) {
+    case 's':
+    case 'm':
+      writePort(port, level);
+      bitWrite(powerBoxConf.portStatus, port, level ? 1 : 0);
+      break;
+    case 'p':
+      writePort(port, level);
+      powerBoxConf.pwmPorts[port - FIRSTPWM] = level;
+      break;
+  }
+}
+
+
+// true while the sequencer has ports to turn on or is waiting after the last one
+bool sequencing() {
+  return seqPending != 0 || millis() - seqStamp < seqWait;
+}
+
+
+// bring the pending ports up one at a time, highest priority first
+// the next port waits for the wait of the previous one, then for the input current to settle below SEQMAXAMPS
+void runSequencer() {
+  long amps;
+  unsigned long elapsed;
+  byte next = PORTNUM;
+
+  if ( !sequencing() )
+    return;
+  amps = applyCal(powerBoxCal[CALINAMPS], latestSample(ADCIIN));
+  if ( amps > seqPeak )
+    seqPeak = amps;
+  elapsed = millis() - seqStamp;
+  if ( seqPending == 0 || elapsed < seqWait )
+    return;
+  if ( amps > SEQMAXAMPS && elapsed < seqWait + SEQTIMEOUT )
+    return;
+  for ( byte i=0; i < PORTNUM; i++) {
+    if ( bitRead(seqPending, i) && (next == PORTNUM || getSequence(i).priority > getSequence(next).priority) )
+      next = i;
+  }
+  DPRINT(F("- sequence port="));
+  DPRINTLN(next);
+  bitClear(seqPending, next);
+  setPort(next, seqLevel[next]);
+  configDirty = true;
+  seqStamp = millis();
+  seqWait = getSequence(next).wait;
+}
+
+
+// hand a port to the sequencer, it is turned on right away unless a sequence is in progress
+void queuePort(byte port, byte level) {
+  if ( !sequencing() )
+    seqPeak = 0;
+  seqLevel[port] = level;
+  bitSet(seqPending, port);
+  runSequencer();
+}
+
+
+void switchPortOn(int port) {
+  DPRINT(F("- spon port="));
+  DPRINTLN(port);
+  if ( port < 0 || port >= PORTNUM )
+    return;
+  // turning a port back on acknowledges its fuse fault and takes it out of the load shedding
+  bitClear(fuseBlown, port);
+  bitClear(shedPorts, port);
+  queuePort(port, portKind(port) == 'p' ? PWMMAX : HIGH);
+  DPRINT(F("- PortStatus="));
+  DPRINTLN(powerBoxConf.portStatus);
+
+  // we may have made a change so write the config to EEPROM
+  writeConfigToEEPROM();
+}
+
+
+void switchPortOff(int port) {
+  DPRINT(F("- spoff port="));
+  DPRINTLN(port);
+  if ( port < 0 || port >= PORTNUM )
+    return;
+  bitClear(seqPending, port);
+  bitClear(shedPorts, port);
+  setPort(port, portKind(port) == 'p' ? PWMMIN : LOW);
+  DPRINT(F("- PortStatus="));
+  DPRINTLN(powerBoxConf.portStatus);
+  // we may have made a change so write the config to EEPROM
+  writeConfigToEEPROM();
+}
+
+
+// called from the fault path, the config is written from the idle state so the cut is not delayed by the EEPROM
+void shutdownAllPorts() {
+  seqPending = 0;
+  shedPorts = 0;
+  for ( byte i=0; i < PORTNUM; i++)
+    setPort(i, LOW);
+  configDirty = true;
+}
+
+
+void setPWMPortLevel(int port, int level) {
+  if ( port >= 0 && port < PORTNUM && portKind(port) == 'p' ) {
+    bitClear(seqPending, port);
+    bitClear(shedPorts, port);
+    // a port coming up from off goes through the sequencer
+    if ( level > PWMMIN && powerBoxConf.pwmPorts[port - FIRSTPWM] == PWMMIN ) {
+      bitClear(fuseBlown, port);
+      queuePort(port, level);
+    } else
+      setPort(port, level);
+    // we may have made a change so write the config to EEPROM
+    writeConfigToEEPROM();
+  }
+}
+
+
+// same function but don't write the EEPROM, the level is throttled while the load is being shed
+// and a shed port stays off, its config still holds the level it comes back to
+void setDewPortLevel(int port, int level) {
+  if ( portKind(port) == 'p' ) {
+    dewLevel[port - FIRSTPWM] = level;
+    writePort(port, bitRead(shedPorts, port) ? PWMMIN : level * (SHEDSTEPS - shedThrottle) / SHEDSTEPS);
+  }
+}
+
+
+// point the 74HC4051 multiplexer and DSEL at the current sense of a port
+// the interrupt ignores ISOUT until the sense has settled on the new port, then checks it against the port trip level
+void selectSense(byte port) {
+  byte chip = portChip(port);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    sensePort = port;
+    senseSettle = SENSESETTLE;
+    tripLevel[ADCIOUT] = portTrip[port];
+  }
+  digitalWrite(DSEL, portDsel(port));
+  digitalWrite(MUX0, bitRead(chip, 0));
+  digitalWrite(MUX1, bitRead(chip, 1));
+  digitalWrite(MUX2, bitRead(chip, 2));
+}
+
+
+void swapPorts() {
+  // move to the next port in the board description and select its current sense
+  // the chip address and DSEL level of each port come from boardPorts[]
+  // a scope capture holds the current sense on its port
+  if ( scopeBusy() )
+    return;
+  portIndex++;
+  // rollover portIndex if we've reached the end
+  if ( portIndex >= PORTNUM )
+    portIndex = 0;
+  selectSense(portIndex);
+#ifdef DEBUG
+  //char buf[40];
+  //sprintf(buf, "- swap: chip=%d, port=%d, dsel=%d", portChip(portIndex), portIndex, portDsel(portIndex));
+  //DPRINTLN(buf);
+#endif
+}
+
+
+//-----------------------------------------------------------------------
+// Fast protection
+//-----------------------------------------------------------------------
+// switch off the Arduino driven outputs of a port, or of every port for ALLPORTS
+// runs in the ADC interrupt so the MCP23017 ports are left to serviceFault()
+void cutPorts(byte port) {
+  for ( byte i=0; i < PORTNUM; i++) {
+    if ( port != ALLPORTS && port != i )
+      continue;
+    if ( portKind(i) == 's' || portKind(i) == 'p' )
+      digitalWrite(portPin(i), LOW);
+  }
+}
+
+
+// scope capture step of the ADC interrupt, true while the capture wants the fast ADC clock
+bool recordScope(byte channel, unsigned int raw) {
+  if ( scopeState == scopeSettling ) {
+    // start on a pass boundary once the port current sense has settled
+    if ( channel == ADCIOUT && senseSettle == 0 ) {
+      scopeState = scopeArmed;
+      scopeTime = micros();
+    }
+    return false;
+  }
+  if ( scopeState != scopeArmed && scopeState != scopeTriggered )
+    return false;
+  if ( scopeSkip == 0 && bitRead(scopeChannels, channel) ) {
+    scopeBuffer[scopeWrite] = raw >> 2;
+    if ( ++scopeWrite >= scopeDepth )
+      scopeWrite = 0;
+  }
+  // ADCIOUT is the last channel of a pass, its sample completes the frame
+  if ( channel != ADCIOUT )
+    return true;
+  if ( scopeSkip == 0 ) {
+    scopeFrames++;
+    if ( scopeState == scopeArmed && scopeFrames > scopePre && raw >= scopeLevel )
+      scopeState = scopeTriggered;
+    if ( scopeState == scopeTriggered && --scopePost == 0 ) {
+      scopeState = scopeDone;
+      scopeTime = micros() - scopeTime;
+    }
+  }
+  if ( ++scopeSkip >= scopeDecimate )
+    scopeSkip = 0;
+  return scopeState != scopeDone;
+}
+
+
+// ADC conversion complete: keep the reading, check it against the channel trip level and start the next channel
+// a channel trips once then needs a reading below its level to re-arm, so a lasting fault is logged only once
+ISR(ADC_vect) {
+  byte channel = adcChannel;
+  unsigned int raw = ADC;
+  bool capturing;
+
+  adcRaw[channel] = raw;
+  if ( channel == ADCIIN && rippleCount < RIPPLESAMPLES ) {
+    rippleSum += raw;
+    rippleSquares += (unsigned long)raw * raw;
+    if ( raw < rippleMin )
+      rippleMin = raw;
+    if ( raw > rippleMax )
+      rippleMax = raw;
+    rippleCount++;
+  }
+  if ( channel == ADCIOUT && senseSettle > 0 ) {
+    senseSettle--;
+  } else if ( raw < tripLevel[channel] ) {
+    tripArmed[channel] = true;
+  } else if ( tripArmed[channel] ) {
+    // a trip is never dropped: while the loop has not finished the previous one it is only latched in the bitmaps
+    tripArmed[channel] = false;
+    cutPorts(channel == ADCIOUT ? sensePort : ALLPORTS);
+    if ( !bitRead(tripPending, channel) ) {
+      tripMicros[channel] = micros();
+      tripRaw[channel] = raw;
+      if ( channel == ADCIOUT )
+        tripPort = sensePort;
+    }
+    if ( channel == ADCIOUT )
+      bitSet(tripPorts, sensePort);
+    bitSet(tripPending, channel);
+  }
+  capturing = recordScope(channel, raw);
+  if ( ++channel >= ADCCHANNELS ) {
+    channel = 0;
+    adcCycles++;
+  }
+  adcChannel = channel;
+  ADMUX = bit(REFS0) | (adcPins[channel] - A0);
+  ADCSRA = (ADCSRA & ~ADCPRESCALE) | (capturing ? SCOPEPRESCALE : ADCPRESCALE) | bit(ADSC);
+}
+
+
+// take the ADC over from analogRead(): AVcc reference, clock/128 and an interrupt at the end of each conversion
+void startSampling() {
+  for ( byte i=0; i < ADCCHANNELS; i++)
+    tripArmed[i] = true;
+  adcChannel = 0;
+  ADMUX = bit(REFS0) | (adcPins[0] - A0);
+  ADCSRA = bit(ADEN) | bit(ADIE) | ADCPRESCALE;
+  ADCSRA |= bit(ADSC);
+}
+
+
+// latest reading of an ADC channel
+unsigned int latestSample(byte channel) {
+  unsigned int raw;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    raw = adcRaw[channel];
+  }
+  return raw;
+}
+
+
+// wait for the interrupt to complete a pass through the channels and return a fresh reading
+unsigned int nextSample(byte channel) {
+  byte cycle = adcCycles;
+  while ( adcCycles == cycle )
+    ;
+  return latestSample(channel);
+}
+
+
+// convert the limits to raw ADC trip levels, has to follow any calibration change
+void updateTripLevels() {
+  for ( byte i=0; i < PORTNUM; i++)
+    portTrip[i] = portKind(i) == 'a' ? NOTRIP : calRaw(powerBoxCal[i], getFuse(i).trip);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    tripLevel[ADCVIN] = calRaw(powerBoxCal[CALINVOLTS], MAXINVOLTS);
+    tripLevel[ADCIIN] = calRaw(powerBoxCal[CALINAMPS], MAXINAMPS);
+    tripLevel[ADCIOUT] = portTrip[sensePort];
+  }
+}
+
+
+// record a fault in the log, a port over current also latches the port fuse
+void logFault(byte cause, byte port, long value, unsigned long latency) {
+  fault_t &fault = faultLog[faultCount % FAULTLOGSIZE];
+
+  fault.time = millis();
+  fault.latency = latency;
+  fault.value = value;
+  fault.cause = cause;
+  fault.port = port;
+  faultCount++;
+  if ( latency > faultWorst )
+    faultWorst = latency;
+  if ( cause == FAULTPORTAMPS || cause == FAULTPORTI2T ) {
+    bitSet(fuseBlown, port);
+    fuseHeat[port] = 0;
+  }
+  DPRINT(F("- fault cause="));
+  DPRINT(cause);
+  DPRINT(F(" port="));
+  DPRINT(port);
+  DPRINT(F(" latency="));
+  DPRINTLN(latency);
+}
+
+
+// finish the trips raised by the interrupt: switch the ports off in the config and on the MCP23017
+// and log the faults, the config write is deferred to the idle state
+// cheap when nothing tripped, so it is called between every step that can block the loop
+void serviceFault() {
+  byte pending;
+  unsigned int ports;
+  byte first;
+  unsigned int raw[ADCCHANNELS];
+  unsigned long stamp[ADCCHANNELS];
+  unsigned long latency;
+
+  if ( tripPending == 0 )
+    return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    pending = tripPending;
+    ports = tripPorts;
+    first = tripPort;
+    for ( byte i = 0; i < ADCCHANNELS; i++ ) {
+      raw[i] = tripRaw[i];
+      stamp[i] = tripMicros[i];
+    }
+    tripPending = 0;
+    tripPorts = 0;
+  }
+  if ( bitRead(pending, ADCVIN) || bitRead(pending, ADCIIN) )
+    shutdownAllPorts();
+  for ( byte i = 0; i < PORTNUM; i++ )
+    if ( bitRead(ports, i) ) {
+      bitClear(seqPending, i);
+      setPort(i, LOW);
+      configDirty = true;
+    }
+  // the latency runs from the first trip of the channel, a port latched behind it logs its trip level
+  if ( bitRead(pending, ADCVIN) ) {
+    latency = micros() - stamp[ADCVIN];
+    logFault(FAULTOVERVOLT, ALLPORTS, applyCal(powerBoxCal[CALINVOLTS], raw[ADCVIN]), latency);
+  }
+  if ( bitRead(pending, ADCIIN) ) {
+    latency = micros() - stamp[ADCIIN];
+    logFault(FAULTINAMPS, ALLPORTS, applyCal(powerBoxCal[CALINAMPS], raw[ADCIIN]), latency);
+  }
+  if ( bitRead(pending, ADCIOUT) ) {
+    latency = micros() - stamp[ADCIOUT];
+    for ( byte i = 0; i < PORTNUM; i++ )
+      if ( bitRead(ports, i) )
+        logFault(FAULTPORTAMPS, i, applyCal(powerBoxCal[i], i == first ? raw[ADCIOUT] : portTrip[i]), latency);
+  }
+}
+
+
+// delay() calls yield() while it waits, so the waits of the probe libraries (a measurement, a sensor reset)
+// service the faults too, replaces the empty one of the Arduino core
+void yield() {
+  serviceFault();
+}
+
+
+// default fuse of every port
+void setDefaultFuses() {
+  const fuse_t fuse = { MAXPORTAMPS, FUSERATED, FUSEI2T };
+
+  for ( byte i=0; i < PORTNUM; i++)
+    putFuse(i, fuse);
+}
+
+
+// default power-on sequence: port order
+void setDefaultSequence() {
+  for ( byte i=0; i < PORTNUM; i++) {
+    sequence_t sequence = { byte(PORTNUM - i), SEQWAIT };
+
+    putSequence(i, sequence);
+  }
+}
+
+
+// time delayed fuse trip, called each time the current of a port is scanned
+// the current is taken as constant since the previous scan: the I2t above the rated current is
+// accumulated, and cools down below it, then the port is cut once its I2t budget is spent
+void checkFuse(byte port) {
+  fuse_t fuse = getFuse(port);
+  unsigned int stamp = millis();
+  unsigned int elapsed = stamp - fuseStamp[port];
+  long amps = powerBoxStatus.portAmps[port];
+  long excess;
+  unsigned long start;
+
+  fuseStamp[port] = stamp;
+  if ( portKind(port) == 'a' )
+    return;
+  if ( elapsed > FUSEMAXSTEP )
+    elapsed = FUSEMAXSTEP;
+  // squares in 0.01A2 so that the product with the elapsed ms fits in a long, /100 gives A2ms
+  excess = amps * amps / 10000 - (long)((unsigned long)fuse.rated * fuse.rated / 10000);
+  fuseHeat[port] += excess * elapsed / 100;
+  if ( fuseHeat[port] < 0 )
+    fuseHeat[port] = 0;
+  if ( fuseHeat[port] > (long)fuse.i2t * 1000 ) {
+    start = micros();
+    setPort(port, LOW);
+    configDirty = true;
+    logFault(FAULTPORTI2T, port, amps, micros() - start);
+  }
+}
+
+
+//-----------------------------------------------------------------------
+// Load shedding
+//-----------------------------------------------------------------------
+// current level of a port, 0 when it is off
+byte portLevel(byte port) {
+  switch ( portKind(port) ) {
+    case 's':
+    case 'm':
+      return bitRead(powerBoxConf.portStatus, port);
+    case 'p':
+      return powerBoxConf.pwmPorts[port - FIRSTPWM];
+  }
+  return 0;
+}
+
+
+// true if a PWM port in a dew heater mode is driven
+bool heatersOn() {
+  for ( byte i=0; i < PWMPORTS; i++) {
+    if ( (powerBoxConf.pwmPortMode[i] == dewHeater || powerBoxConf.pwmPortMode[i] == tempFeedback) && dewLevel[i] > 0 )
+      return true;
+  }
+  return false;
+}
+
+
+// write the dew heaters again after a throttle change
+void applyThrottle() {
+  for ( byte i=0; i < PWMPORTS; i++) {
+    if ( powerBoxConf.pwmPortMode[i] == dewHeater || powerBoxConf.pwmPortMode[i] == tempFeedback )
+      setDewPortLevel(FIRSTPWM + i, dewLevel[i]);
+  }
+}
+
+
+// keep the filtered input current within the budget and the filtered input voltage above the low voltage
+// disconnect, one step every SHEDINTERVAL: the dew heaters are throttled first, then the lowest priority port
+// that is on is switched off. Once the current is below the budget minus the headroom and the voltage
+// has risen above the restore level, the highest priority shed port is restored first, then the heaters
+void checkLoad() {
+  long budget = getParam(PARAMBUDGET);
+  long cut = getParam(PARAMLVDCUT);
+  bool overBudget = budget > 0 && filteredAmps > budget;
+  bool underVolts = cut > 0 && filteredVolts < cut;
+  byte port = PORTNUM;
+
+  // the disconnect holds the shed ports until the voltage is back above the restore level
+  if ( underVolts )
+    lowVoltage = true;
+  else if ( cut <= 0 || filteredVolts > getParam(PARAMLVDRESTORE) )
+    lowVoltage = false;
+  if ( millis() - shedStamp < SHEDINTERVAL )
+    return;
+  if ( overBudget || underVolts ) {
+    shedStamp = millis();
+    if ( shedThrottle < SHEDSTEPS && heatersOn() ) {
+      shedThrottle++;
+      applyThrottle();
+      return;
+    }
+    for ( byte i=0; i < PORTNUM; i++) {
+      if ( portKind(i) == 'a' || portLevel(i) == 0 || bitRead(shedPorts, i) )
+        continue;
+      if ( port == PORTNUM || getSequence(i).priority < getSequence(port).priority )
+        port = i;
+    }
+    if ( port == PORTNUM )
+      return;
+    // shedding is not persisted, only the output is cut and the config keeps the port on for the next boot
+    seqLevel[port] = portLevel(port);
+    writePort(port, LOW);
+    bitSet(shedPorts, port);
+    if ( underVolts )
+      logFault(FAULTLOWVOLT, port, filteredVolts, 0);
+    else
+      logFault(FAULTSHED, port, filteredAmps, 0);
+  } else if ( !lowVoltage && (budget <= 0 || filteredAmps < budget - getParam(PARAMHEADROOM)) ) {
+    for ( byte i=0; i < PORTNUM; i++) {
+      if ( bitRead(shedPorts, i) && (port == PORTNUM || getSequence(i).priority > getSequence(port).priority) )
+        port = i;
+    }
+    if ( port != PORTNUM ) {
+      shedStamp = millis();
+      bitClear(shedPorts, port);
+      queuePort(port, seqLevel[port]);
+    } else if ( shedThrottle > 0 ) {
+      shedStamp = millis();
+      shedThrottle--;
+      applyThrottle();
+    }
+  }
+}
+
+
+// battery state of charge, called at every read cycle
+// the input current is integrated (coulomb counting) and the charge is slowly pulled towards the
+// estimate from the rest voltage, the voltage under load corrected by the internal resistance,
+// so the count does not drift and the first estimate comes from the voltage alone
+void updateCharge() {
+  // a hundredth of a mAh keeps MAXCAPACITY well within a long
+  long capacity = getParam(PARAMCAPACITY) * (3600000L / CHARGEUNIT);
+  long empty = getParam(PARAMVEMPTY);
+  long span = getParam(PARAMVFULL) - empty;
+  unsigned long stamp = millis();
+  unsigned long elapsed = stamp - chargeStamp;
+  long rest;
+  long restCharge;
+
+  chargeStamp = stamp;
+  if ( capacity <= 0 || span <= 0 ) {
+    batteryCharge = -1;
+    batterySoc = -1;
+    return;
+  }
+  rest = powerBoxStatus.inputVolts + powerBoxStatus.inputAmps * getParam(PARAMRESIST) / 1000;
+  restCharge = capacity / span * constrain(rest - empty, 0, span);
+  if ( batteryCharge < 0 ) {
+    batteryCharge = restCharge;
+    chargeCarry = 0;
+    chargeBlend = 0;
+  } else {
+    // mA times ms, the whole units go to the charge and the rest is carried to the next read
+    chargeCarry += powerBoxStatus.inputAmps * (long)elapsed;
+    batteryCharge -= chargeCarry / CHARGEUNIT;
+    chargeCarry %= CHARGEUNIT;
+    // the pull is carried the same way, so a difference smaller than SOCBLEND units still moves the charge
+    chargeBlend += restCharge - batteryCharge;
+    batteryCharge += chargeBlend / SOCBLEND;
+    chargeBlend %= SOCBLEND;
+  }
+  batteryCharge = constrain(batteryCharge, 0, capacity);
+  batterySoc = batteryCharge / (capacity / 100);
+}
+
+
+// the battery settings have to make sense together, the U command refuses a value that breaks them
+// value is checked as setting id, with the other settings as they are in EEPROM
+bool validParams(byte id, long value) {
+  long param[PARAMS];
+
+  for ( byte i=0; i < PARAMS; i++ )
+    param[i] = i == id ? value : getParam(i);
+
+  if ( param[PARAMCAPACITY] < 0 || param[PARAMCAPACITY] > MAXCAPACITY || param[PARAMRESIST] < 0 || param[PARAMRESIST] > MAXRESIST )
+    return false;
+  if ( param[PARAMLVDCUT] < 0 || (param[PARAMLVDCUT] > 0 && param[PARAMLVDRESTORE] <= param[PARAMLVDCUT]) )
+    return false;
+  return param[PARAMVFULL] > param[PARAMVEMPTY];
+}
+
+
+// default scalar settings, by id
+const long paramDefaults[PARAMS] PROGMEM = { SHEDBUDGET, SHEDHEADROOM, LVDCUT, LVDRESTORE, BATTCAPACITY,
+                                             BATTVEMPTY, BATTVFULL, BATTRESIST, PWMPHASE, HISTORYITVL };
+
+void setDefaultParams() {
+  for ( byte i=0; i < PARAMS; i++ )
+    putParam(i, pgm_read_dword(&paramDefaults[i]));
+}
+
+
+//-----------------------------------------------------------------------
+// Scope capture
+//-----------------------------------------------------------------------
+// true while the capture holds the current sense on its port
+bool scopeBusy() {
+  return scopeState == scopeSettling || scopeState == scopeArmed || scopeState == scopeTriggered;
+}
+
+
+// capture the current of a port, and the input voltage and current for the bits 0 and 1 of inputs,
+// once it reaches trigger mA with pre % of the buffer before the trigger, recording one pass out of decimate
+// the current sense moves to the port right away and stays there until the capture is done or times out,
+// meanwhile the port scan is held: the captured port keeps its fast trip and I2t, the input voltage and
+// current keep their fast trips, which cut every port, and the other ports only resume their own checks after
+bool startScope(int port, byte inputs, long trigger, long pre, long decimate) {
+  unsigned int frames;
+
+  if ( port < 0 || port >= PORTNUM || pre < 0 || pre > 100 || decimate < 1 || decimate > SCOPEMAXDECIMATE )
+    return false;
+  // the interrupt only looks at the capture once it is settling
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    scopeState = scopeIdle;
+  }
+  scopePort = port;
+  scopeChannels = bit(ADCIOUT) | (inputs & (bit(ADCVIN) | bit(ADCIIN)));
+  scopeFrame = bitRead(scopeChannels, ADCVIN) + bitRead(scopeChannels, ADCIIN) + 1;
+  frames = SCOPESIZE / scopeFrame;
+  scopeDepth = frames * scopeFrame;
+  // the trigger frame is the first one after the pre-trigger frames
+  scopePre = (frames - 1) * pre / 100;
+  scopeLevel = trigger > 0 ? calRaw(powerBoxCal[port], trigger) : 0;
+  scopeDecimate = decimate;
+  scopePost = frames - scopePre;
+  scopeSkip = 0;
+  scopeWrite = 0;
+  scopeFrames = 0;
+  scopeStamp = millis();
+  // the scan resumes from the captured port once the capture hands the sense back
+  portIndex = port;
+  selectSense(port);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    scopeState = scopeSettling;
+  }
+  return true;
+}
+
+
+// give up on a capture whose trigger does not come, so the other ports get their checks back
+// a triggered capture lasts at most SCOPESIZE * SCOPEMAXDECIMATE passes and is left to finish
+void runScope() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if ( (scopeState == scopeSettling || scopeState == scopeArmed) && millis() - scopeStamp > SCOPETIMEOUT )
+      scopeState = scopeTimeout;
+  }
+}
+
+
+// '>c:<state>:<port>:<channels>:<period>:<pre>:<frames>:<length>:<data>#' once the capture is done, '>c:<state>#' until then
+// <period> is the time between two frames in tenths of us, the trigger frame follows the <pre> first frames
+// <data> is <length> binary bytes, the frames oldest first, each the 8 bit samples of the <channels> bitmap in channel order
+void sendScope() {
+  DPRINTLN(F("- Send: scope"));
+  if ( scopeState != scopeDone ) {
+    sprintf_P(reply, PSTR(">c:%d#"), scopeState);
+    sendPacket(reply);
+    return;
+  }
+  sprintf_P(reply, PSTR(">c:%d:%02d:%d:%lu:%u:%u:%u:"), scopeState, scopePort, scopeChannels, scopeTime * 10 / scopeFrames,
+    scopePre, scopeDepth / scopeFrame, scopeDepth);
+  sendPacket(reply);
+  // the faults are serviced while the serial buffer is full
+  for ( unsigned int i = 0; i < scopeDepth; i++ ) {
+    serialRoom(1);
+    Serial.write(scopeBuffer[(scopeWrite + i) % scopeDepth]);
+  }
+  sendPacket(F("#"));
+}
+
+
+//-----------------------------------------------------------------------
+// Telemetry history
+//-----------------------------------------------------------------------
+// tenths of a probe reading, a failed reading is recorded as 0
+int16_t tenths(float value) {
+  return isnan(value) ? 0 : fixRound(value * 10);
+}
+
+
+// the current value of history field f, gap is the seconds since the previous record
+int16_t historyValue(byte f, int16_t gap) {
+  switch ( f ) {
+    case 0: return gap;
+    case 1: return powerBoxStatus.inputAmps / 10;
+    case 2: return powerBoxStatus.inputVolts / 10;
+    case 3: return tenths(powerBoxStatus.temp);
+    case 4: return tenths(powerBoxStatus.humid);
+    case 5: return tenths(powerBoxStatus.dewpoint);
+  }
+  if ( f < HISTSLOWFIELDS + PORTNUM )
+    return powerBoxStatus.portAmps[f - HISTSLOWFIELDS] / 100;
+  return pwmOut[f - HISTSLOWFIELDS - PORTNUM];
+}
+
+
+byte histByte(unsigned int offset) {
+  return histRing[(histHead + offset) % HISTORYSIZE];
+}
+
+
+// reads the varint at offset, moving offset past it
+uint32_t readVarint(unsigned int &offset) {
+  uint32_t value = 0;
+  byte shift = 0;
+  byte b;
+
+  do {
+    b = histByte(offset++);
+    value |= (uint32_t)(b & 0x7F) << shift;
+    shift += 7;
+  } while ( b & 0x80 );
+  return value;
 }
 
 
-//-----------------------------------------------------------------------
-// Port Operations
-//-----------------------------------------------------------------------
-void getStatusString() {
-  // return a status string to the driver with the following info:
-  // - a bitmap of port statuses following the boardSignature format
-  // the current of each port
-  // the in current
-  // the in voltage
-  // current temperature
-  // current humidity
-  // 0:0:0:0:0:0:0:0:127:255:195:100:1:1:5.54:5.49:5.42:5.37:5.44:5.49:5.54:5.49:5.39:5.49:5.44:5.37:0.22:0.23:0.07:3.37:0.00:0.00
-  // TODO make this modular and based on boardSignature
+// writes value as a varint at offset past the newest record, returns its length
+byte writeVarint(unsigned int offset, uint32_t value) {
+  byte length = 0;
 
-  // port status
-  status = "";
-  for ( int i=0; i < 8; i++) {
-    status += bitRead(powerBoxConf.portStatus, i);
-    status += ":";
-  }
-  // PWM port duty cycles
-  for ( int i=0; i < sizeof(powerBoxConf.pwmPorts); i++) {
-    status += powerBoxConf.pwmPorts[i];
-    status += ":";
-  }
-  // the 2 always-on ports
-  status += "1:1:";
-  // port currents
-  for ( int i=0; i < (sizeof(powerBoxStatus.portAmps) / sizeof(float)); i++) {
-    status += powerBoxStatus.portAmps[i];
-    status += ":";
-  }
-  // input Amps
-  status += powerBoxStatus.inputAmps;
-  status += ":";
-  // input Volts
-  status += powerBoxStatus.inputVolts;
-  // Temperatures
-  if (haveTemp) {
-    status += ":";
-    // temperature
-    status += powerBoxStatus.temp;
-    status += ":";
-    // humidity
-    status += powerBoxStatus.humid;
-    status += ":";
-    // dewpoint
-    status += powerBoxStatus.dewpoint;
-    // pressure
-    if (havePress) {
-      status += ":";
-      status += powerBoxStatus.pressure;
-    }
-    for ( int i = 1; i < probeCount ; i++ ) {
-      status += ":";
-      // temperature
-      status += powerBoxStatus.tempProbe[i];
+  do {
+    byte b = value & 0x7F;
+
+    value >>= 7;
+    histRing[(histHead + offset + length++) % HISTORYSIZE] = value ? b | 0x80 : b;
+  } while ( value );
+  return length;
+}
+
+
+byte varintLength(uint32_t value) {
+  byte length = 1;
+
+  while ( value >>= 7 )
+    length++;
+  return length;
+}
+
+
+inline uint16_t zigzag(int16_t value) {
+  return ((uint16_t)value << 1) ^ (uint16_t)(value >> 15);
+}
+
+
+// adds the changes of the record at offset to values, returns the record length
+unsigned int decodeRecord(unsigned int offset, int16_t *values) {
+  unsigned int pos = offset;
+  uint32_t map = readVarint(pos);
+
+  for ( byte f = 0; f < HISTFIELDS; f++ ) {
+    if ( map & (1UL << (f + 1)) ) {
+      uint16_t value = readVarint(pos);
+
+      values[f] += (int16_t)((value >> 1) ^ -(value & 1));
     }
   }
+  return pos - offset;
 }
 
 
-void switchPortOn(int port) {
-  // determine the type of port
-  DPRINT(F("- spon port="));
-  DPRINTLN(port);
-  if ( boardSignature[port] == 's' ) {
-    // normal on/off port
-    if ( bitRead(powerBoxConf.portStatus, port) == 0x00 ) {
-      digitalWrite(ports2Pin[port], HIGH);
-      powerBoxConf.portStatus = powerBoxConf.portStatus + port2bin[port];
-    }
+// appends a record of the current values, the oldest records make room for it
+// the port fields are only compared every HISTORYPORTS records, in between they count as steady
+void recordHistory(int16_t gap) {
+  int16_t change[HISTFIELDS];
+  bool ports = histPortSkip == 0;
+  uint32_t map = ports ? 1 : 0;
+  byte length = 0;
+
+  // the newest values are the base plus the changes of every record
+  memcpy(change, histBase, sizeof(change));
+  for ( unsigned int offset = 0; offset < histUsed; )
+    offset += decodeRecord(offset, change);
+  for ( byte f = 0; f < HISTFIELDS; f++ ) {
+    change[f] = f < HISTSLOWFIELDS || ports ? (int16_t)((uint16_t)historyValue(f, gap) - (uint16_t)change[f]) : 0;
+    if ( change[f] == 0 )
+      continue;
+    map |= 1UL << (f + 1);
+    length += varintLength(zigzag(change[f]));
   }
-  if ( boardSignature[port] == 'm' ) {
-    // multiplex on/off port
-    mcp.digitalWrite(ports2Pin[port], HIGH);
-    if ( bitRead(powerBoxConf.portStatus, port) == 0x00 ) {
-      powerBoxConf.portStatus = powerBoxConf.portStatus + port2bin[port];
-    }
-    DPRINTLN(mcp.readGPIO());
+  length += varintLength(map);
+  while ( HISTORYSIZE - histUsed < length ) {
+    unsigned int evicted = decodeRecord(0, histBase);
+
+    histHead = (histHead + evicted) % HISTORYSIZE;
+    histUsed -= evicted;
+    histCount--;
   }
-  if ( boardSignature[port] == 'p' ) {
-    // PWM on/off port
-    if (powerBoxConf.pwmPorts[port - boardSignature.indexOf("p")] != PWMMAX ) {
-      analogWrite(ports2Pin[port], PWMMAX);
-      powerBoxConf.pwmPorts[port - boardSignature.indexOf("p")] = PWMMAX;
-    }
+  length = writeVarint(histUsed, map);
+  for ( byte f = 0; f < HISTFIELDS; f++ ) {
+    if ( change[f] )
+      length += writeVarint(histUsed + length, zigzag(change[f]));
   }
-  DPRINT(F("- PortStatus="));
-  DPRINTLN(powerBoxConf.portStatus);
+  histUsed += length;
+  histCount++;
+  histPortSkip = ports ? HISTORYPORTS - 1 : histPortSkip - 1;
+}
 
-  // we may have made a change so write the config to EEPROM
-  writeConfigToEEPROM();
+
+// each record carries the seconds since the previous one, so a change of the interval does not re-time the older records
+void runHistory() {
+  long interval = getParam(PARAMHISTORY);
+  unsigned long elapsed = millis() - histStamp;
+
+  if ( interval <= 0 || elapsed < interval * 1000UL )
+    return;
+  histStamp += elapsed;
+  recordHistory(min((elapsed + 500) / 1000, 32767UL));
 }
 
 
-void switchPortOff(int port) {
-  // determine the type of port
-  DPRINT(F("- spoff port="));
-  DPRINTLN(port);
-  if ( boardSignature[port] == 's' ) {
-    // normal on/off port
-    if ( bitRead(powerBoxConf.portStatus, port) == 0x01 ) {
-      digitalWrite(ports2Pin[port], LOW);
-      powerBoxConf.portStatus = powerBoxConf.portStatus - port2bin[port];
-    }
-  }
-  if ( boardSignature[port] == 'm' ) {
-    // multiplex on/off port
-    mcp.digitalWrite(ports2Pin[port], LOW);
-    if ( bitRead(powerBoxConf.portStatus, port) == 0x01 ) {
-      powerBoxConf.portStatus = powerBoxConf.portStatus - port2bin[port];
-    }
-    DPRINTLN(mcp.readGPIO());
+// '>h:<interval>:<age>:<records>:<fields>:<length>:<data>#', <age> is the ms since the newest record
+// <data> is <length> binary bytes: the 16 bit little endian value of each field before the oldest record
+// then the records, oldest first. The data may hold '#' so the host reads <length> bytes before the end marker
+void sendHistory() {
+  DPRINTLN(F("- Send: history"));
+  sprintf_P(reply, PSTR(">h:%ld:%lu:%u:%u:%u:"), getParam(PARAMHISTORY), histCount ? millis() - histStamp : 0UL,
+    histCount, HISTFIELDS, HISTFIELDS * 2 + histUsed);
+  sendPacket(reply);
+  for ( byte f = 0; f < HISTFIELDS; f++ ) {
+    serialRoom(2);
+    Serial.write(lowByte(histBase[f]));
+    Serial.write(highByte(histBase[f]));
   }
-  if ( boardSignature[port] == 'p' ) {
-    // PWM on/off port
-    if (powerBoxConf.pwmPorts[port - boardSignature.indexOf("p")] != PWMMIN ) {
-      analogWrite(ports2Pin[port], PWMMIN);
-      powerBoxConf.pwmPorts[port - boardSignature.indexOf("p")] = PWMMIN;
-    }
+  for ( unsigned int i = 0; i < histUsed; i++ ) {
+    serialRoom(1);
+    Serial.write(histByte(i));
   }
-  DPRINT(F("- PortStatus="));
-  DPRINTLN(powerBoxConf.portStatus);
-  // we may have made a change so write the config to EEPROM
-  writeConfigToEEPROM();
+  sendPacket(F("#"));
 }
 
 
-void shutdownAllPorts() {
-  for ( int i=0; i < boardSignature.length(); i++) {
-    if ( boardSignature[i] == 's' ) {
-      // normal on/off port
-      if ( bitRead(powerBoxConf.portStatus, i) == 1 ) {
-        digitalWrite(ports2Pin[i], LOW);
-        powerBoxConf.portStatus = powerBoxConf.portStatus - port2bin[i];
-      }
-    }
-    if ( boardSignature[i] == 'm' ) {
-      // multiplex on/off port
-      if ( bitRead(powerBoxConf.portStatus, i) == 1 ) {
-        mcp.digitalWrite(ports2Pin[i], LOW);
-        powerBoxConf.portStatus = powerBoxConf.portStatus - port2bin[i];
-      }
-    }
-    if ( boardSignature[i] == 'p' ) {
-      // PWM on/off port
-      if (powerBoxConf.pwmPorts[i - boardSignature.indexOf("p")] != PWMMIN) {
-        analogWrite(ports2Pin[i], PWMMIN);
-        powerBoxConf.pwmPorts[i - boardSignature.indexOf("p")] = PWMMIN;
-      }
-    }
-  }
-  // we may have made a change so write the config to EEPROM
-  writeConfigToEEPROM();
+// empties the ring, the next record is a change from the newest one and samples the ports
+void clearHistory() {
+  for ( unsigned int offset = 0; offset < histUsed; )
+    offset += decodeRecord(offset, histBase);
+  histHead = 0;
+  histUsed = 0;
+  histCount = 0;
+  histPortSkip = 0;
 }
 
 
-void setPWMPortLevel(int port, int level) {
-  if ( boardSignature[port] == 'p' ) {
-    // PWM on/off port
-    if (powerBoxConf.pwmPorts[port - boardSignature.indexOf("p")] != level) {
-      analogWrite(ports2Pin[port], level);
-      powerBoxConf.pwmPorts[port - boardSignature.indexOf("p")] = level;
-    }
-    // we may have made a change so write the config to EEPROM
-    writeConfigToEEPROM();
+//-----------------------------------------------------------------------
+// Calibration
+//-----------------------------------------------------------------------
+// default fixed point calibration of every ADC channel, computed from the board description
+void setDefaultCalibration() {
+  for ( byte i=0; i < PORTNUM; i++)
+    powerBoxCal[i] = portSensor(i) == CC6900_10A ? senseCal<CC6900_10A>() : senseCal<BTS7008>();
+  powerBoxCal[CALINAMPS] = senseCal<CC6900_30A>();
+  powerBoxCal[CALINVOLTS] = dividerCal();
+  for ( byte i=0; i < CALCHANNELS; i++)
+    putCalibration(i);
+}
+
+
+// settings written before they had a version: they ended the EEPROM, with a header of validData and length
+// and the scalar settings, PARAMS of them at most, before the dew heater control
+// they are moved to the current layout in place: that copy starts above EEPROMSETBASE so the calibration, fuses
+// and sequence are copied down in order, the scalar and dew settings overlap their new place and go through the stack
+bool migrateSettings() {
+  const int head = sizeof(byte) + sizeof(int);
+  const int members = offsetof(settings_t, dew) - offsetof(settings_t, cal);
+
+  for ( byte n = PARAMS; n > 0; n-- ) {
+    int length = head + members + n * sizeof(long) + PWMPORTS * sizeof(dew_t);
+    int address = E2END + 1 - length;
+    int stored;
+    long param[PARAMS];
+    dew_t dew[PWMPORTS];
+
+    EEPROM.get(address + 1, stored);
+    if ( EEPROM.read(address) != SETTINGSFLAG || stored != length )
+      continue;
+    address += head;
+    for ( int i=0; i < members; i++ )
+      EEPROM.update(SETTINGADDR(cal) + i, EEPROM.read(address + i));
+    address += members;
+    for ( byte i=0; i < PARAMS; i++ )
+      param[i] = pgm_read_dword(&paramDefaults[i]);
+    for ( byte i=0; i < n; i++, address += sizeof(long) )
+      EEPROM.get(address, param[i]);
+    EEPROM.get(address, dew);
+    updateEEPROM(SETTINGADDR(dew), dew, sizeof(dew));
+    updateEEPROM(SETTINGADDR(param), param, sizeof(param));
+    return true;
   }
+  return false;
 }
 
 
-// same function but don't write the EEPROM
-void setDewPortLevel(int port, int level) {
-    // PWM on/off port
-    if ( boardSignature[port] == 'p' ) {
-      analogWrite(ports2Pin[port], level);
-	} 
+// complete the settings in EEPROM, the stored copy may be shorter or from before the versions, then read the calibration
+// members are only appended so the ones that end past the stored length get their defaults
+void loadSettings() {
+  int length;
+
+  EEPROM.get(SETTINGADDR(length), length);
+  if ( EEPROM.read(SETTINGADDR(validData)) == SETTINGSFLAG && EEPROM.read(SETTINGADDR(version)) == SETTINGSVERSION &&
+       length > (int)offsetof(settings_t, cal) && length <= (int)sizeof(settings_t) ) {
+    if ( length < (int)sizeof(settings_t) )
+      DPRINTLN(F("- settings extended with defaults"));
+  } else if ( migrateSettings() ) {
+    DPRINTLN(F("- settings migrated"));
+    length = sizeof(settings_t);
+  } else {
+    DPRINTLN(F("- no valid settings, using defaults"));
+    length = 0;
+  }
+  if ( length < (int)offsetof(settings_t, fuse) )
+    setDefaultCalibration();
+  if ( length < (int)offsetof(settings_t, sequence) )
+    setDefaultFuses();
+  if ( length < (int)offsetof(settings_t, dew) )
+    setDefaultSequence();
+  if ( length < (int)offsetof(settings_t, param) )
+    setDefaultDew();
+  for ( byte i=0; i < PARAMS; i++ ) {
+    if ( length < (int)(offsetof(settings_t, param) + (i + 1) * sizeof(long)) )
+      putParam(i, pgm_read_dword(&paramDefaults[i]));
+  }
+  // the scalar settings were not always checked, a stored capacity could overflow the charge count
+  if ( !validParams(PARAMBUDGET, getParam(PARAMBUDGET)) ) {
+    DPRINTLN(F("- invalid scalar settings, using defaults"));
+    setDefaultParams();
+  }
+  if ( length != sizeof(settings_t) ) {
+    EEPROM.update(SETTINGADDR(validData), SETTINGSFLAG);
+    EEPROM.put(SETTINGADDR(length), (int)sizeof(settings_t));
+    EEPROM.update(SETTINGADDR(version), SETTINGSVERSION);
+  }
+  EEPROM.get(SETTINGADDR(cal), powerBoxCal);
 }
 
 
-void swapPorts() {
-  // when the controller starts
-  // portIndex = 0
-  // DSEL = HIGH
-  // MUX0=MUX1=MUX2=0
-  // this points to the first logical port and output 2 of the first BTS7008 switch
-  // portIndex starts at 0 but port numbers at 1 <- TODO stop this BS, do it in the UI
-
-  // increment portIndex
-  portIndex++;
-  // rollover portIndex if we've reached the end
-  if ( portIndex >= portMax )
-    portIndex = 0;
+// sum of CALSAMPLES raw readings of a channel, ports are read through the current sense multiplexer
+unsigned int sampleChannel(byte channel) {
+  unsigned int sum = 0;
+  byte adc = ADCIOUT;
 
-  // each time we call swapPorts() we need to inverse DSEL except for the 
-  // always on ports but since there are 2 of them we don't care
-  dsel = !dsel;
-  digitalWrite(DSEL, dsel);
-
-  // every even portIndex we need to change the mux to the next value
-  if ( (portIndex % 2) == 0 )
-    chip++;
-  // dirty ugly hack for our board but no good for modular hardware
-  if ( portIndex == 13 )
-    chip++;
-  // rollover the chip if we are beyond the max
-  if ( chip > portMax / 2 )
-    chip = 0;
-  // determine the values of MUXx from chip and write them
-  digitalWrite(MUX0, bitRead(chip, 0));
-  digitalWrite(MUX1, bitRead(chip, 1));
-  digitalWrite(MUX2, bitRead(chip, 2));
-  // done
-#ifdef DEBUG
-  //char buf[40];
-  //sprintf(buf, "- swap: chip=%d, port=%d, dsel=%d", chip, portIndex, dsel);
-  //DPRINTLN(buf);
-  //sprintf(buf, "- mux: c=%d, 0=%d, 1=%d, 2=%d", chip, bitRead(chip, 0), bitRead(chip, 1), bitRead(chip, 2));
-  //DPRINTLN(buf);
-#endif
+  if ( channel == CALINAMPS )
+    adc = ADCIIN;
+  if ( channel == CALINVOLTS )
+    adc = ADCVIN;
+  if ( channel < PORTNUM ) {
+    selectSense(channel);
+    delay(CALSETTLE);
+  }
+  for ( byte i=0; i < CALSAMPLES; i++)
+    sum += nextSample(adc);
+  // give the sense back to the port being scanned
+  if ( channel < PORTNUM )
+    selectSense(portIndex);
+  return sum;
+}
+
+
+// fit the calibration of a channel against a known load in milli-units (mA, or mV for the input voltage)
+// a load of 0 records the zero point and moves the offset, any other load fits the gain through the offset
+// so the zero point should be calibrated first
+void calibrateChannel(byte channel, long milli) {
+  unsigned int sum = sampleChannel(channel);
+  cal_t &c = powerBoxCal[channel];
+
+  DPRINT(F("- calibrate channel="));
+  DPRINT(channel);
+  DPRINT(F(" sum="));
+  DPRINTLN(sum);
+  if ( milli == 0 )
+    c.offset = -((((long)sum * c.gain) >> CALSHIFT) / CALSAMPLES);
+  else if ( sum > 0 )
+    c.gain = ((milli - c.offset) << CALSHIFT) * CALSAMPLES / sum;
+  putCalibration(channel);
+  updateTripLevels();
 }
 
 
 //-----------------------------------------------------------------------
 // Dew Control
 //-----------------------------------------------------------------------
+// one PID step of a PWM port in temperature feedback mode, dt in seconds
+// anti-windup: the integral only moves while the output is not saturated in the direction of
+// the error, and it is bounded to the output range
+int computePid(byte index, float error, float dt) {
+  dew_t gains = getDew(index);
+  float derivative = (error - dewError[index]) / dt;
+  float output = gains.kp * error + dewIntegral[index] + gains.kd * derivative;
+
+  if ( (output < PWMMAX || error < 0) && (output > PWMMIN || error > 0) ) {
+    dewIntegral[index] = constrain(dewIntegral[index] + gains.ki * error * dt, PWMMIN, PWMMAX);
+    output = gains.kp * error + dewIntegral[index] + gains.kd * derivative;
+  }
+  return constrain(output, PWMMIN, PWMMAX);
+}
+
+
+// called at every loop pass, each PWM port runs a control step every period of its own
+// with the latest probe readings
 void adjustDewHeaters() {
-  int pwmPort;
-  int pwmPortNum = 0;
   int level;
+  float error;
+  float dt;
 
-  pwmPortNum = sizeof(powerBoxConf.pwmPorts);
-  // PWM ports start at boardSignature.indexOf("p")
+  // PWM ports start at FIRSTPWM
   //
-  for ( int port=boardSignature.indexOf("p"); port < pwmPortNum + boardSignature.indexOf("p"); port++) {
+  for ( int port=FIRSTPWM; port < FIRSTPWM + PWMPORTS; port++) {
 
     // Zero based index for probes 
     //
-    int index = port - boardSignature.indexOf("p");
+    int index = port - FIRSTPWM;
+    unsigned long elapsed = millis() - dewStamp[index];
+
+    // the auto-tune drives the port itself
+    if ( tuneState == tuneRunning && port == tunePort )
+      continue;
+
+    unsigned int period = getDew(index).period;
+
+    if ( dewStamp[index] != 0 && elapsed < period * 1000UL )
+      continue;
+    dt = dewStamp[index] == 0 ? period : elapsed / 1000.0;
+    dewStamp[index] = millis();
     if ( powerBoxConf.pwmPortMode[index] == dewHeater ) {
-      if (powerBoxStatus.temp < powerBoxStatus.dewpoint + powerBoxConf.pwmPortTempOffset[index]) {
+      error = powerBoxStatus.dewpoint + powerBoxConf.pwmPortTempOffset[index] - powerBoxStatus.temp;
+      if ( error > 0 ) {
         // As of now powerBoxConf.pwmPortPreset is not being initialized anywhere. Use powerBoxConf.pwmPorts for now 
         // TBD: do something meaningful with powerBoxConf.pwmPortPreset
         //
         setDewPortLevel(port, int(powerBoxConf.pwmPorts[index]));
-      } else if ( powerBoxStatus.temp > powerBoxStatus.dewpoint + powerBoxConf.pwmPortTempOffset[index]) {
-        setDewPortLevel(port, PWMMIN);;
+      } else if ( error < 0 ) {
+        setDewPortLevel(port, PWMMIN);
       }
+      dewError[index] = error;
     }
     if ( powerBoxConf.pwmPortMode[index] == tempFeedback ) {
-      if ( powerBoxStatus.tempProbe[index] < powerBoxStatus.dewpoint + powerBoxConf.pwmPortTempOffset[index]) {
-        pid[port- boardSignature.indexOf("p")].setpoint(powerBoxStatus.dewpoint + powerBoxConf.pwmPortTempOffset[index]);
-        level = int(pid[index].compute(powerBoxStatus.tempProbe[index]));
-        DPRINT(F("tempfeedbck set port "));
-        DPRINT(port);
-        DPRINT(F(" power: "));
-        DPRINTLN(level);
-        setDewPortLevel(port, level);
+      error = powerBoxStatus.dewpointProbe[index] + powerBoxConf.pwmPortTempOffset[index] - powerBoxStatus.tempProbe[index];
+      level = computePid(index, error, dt);
+      dewError[index] = error;
+      DPRINT(F("tempfeedbck set port "));
+      DPRINT(port);
+      DPRINT(F(" power: "));
+      DPRINTLN(level);
+      setDewPortLevel(port, level);
+    }
+  }
+}
+
+
+// relay feedback auto-tune of a PWM port in temperature feedback mode
+// the port is switched full on below the setpoint and off above it, the probe temperature then
+// oscillates around the setpoint. The period Tu and amplitude a of the oscillation give the ultimate
+// gain Ku = 4d / (pi a) for a relay of amplitude d, the gains follow the Tyreus-Luyben PI rule that
+// trades a slower response for little overshoot, a heater has no active cooling
+void startAutotune(byte port) {
+  byte index = port - FIRSTPWM;
+
+  if ( port < FIRSTPWM || port >= FIRSTPWM + PWMPORTS || powerBoxConf.pwmPortMode[index] != tempFeedback || index >= probeCount ) {
+    tuneState = tuneFailed;
+    return;
+  }
+  tunePort = port;
+  tuneCycle = 0;
+  tuneHigh = true;
+  tuneTarget = powerBoxStatus.tempProbe[index] + TUNERISE;
+  tuneMax = tuneMin = powerBoxStatus.tempProbe[index];
+  tunePeriods = tuneAmplitudes = 0;
+  tuneStart = millis();
+  tuneSwitch = 0;
+  tuneState = tuneRunning;
+  setDewPortLevel(port, PWMMAX);
+}
+
+
+// ends the auto-tune, the dew control takes the port back at its next step
+void stopAutotune(byte state) {
+  byte index = tunePort - FIRSTPWM;
+
+  tuneState = state;
+  setDewPortLevel(tunePort, PWMMIN);
+  dewIntegral[index] = 0;
+  dewError[index] = 0;
+  dewStamp[index] = 0;
+}
+
+
+// called with every new probe reading
+void runAutotune() {
+  byte index = tunePort - FIRSTPWM;
+  float temp = powerBoxStatus.tempProbe[index];
+  unsigned long now = millis();
+
+  if ( tuneState != tuneRunning )
+    return;
+  if ( powerBoxConf.pwmPortMode[index] != tempFeedback || now - tuneStart > TUNETIMEOUT * 60000UL ) {
+    stopAutotune(tuneFailed);
+    return;
+  }
+  tuneMax = max(tuneMax, temp);
+  tuneMin = min(tuneMin, temp);
+
+  if ( tuneHigh && temp > tuneTarget + TUNEHYST ) {
+    // a cycle runs from one switch off to the next, the warm up and the first cycle are not measured
+    if ( tuneSwitch != 0 ) {
+      tuneCycle++;
+      if ( tuneCycle > 1 ) {
+        tunePeriods += (now - tuneSwitch) / 1000.0;
+        tuneAmplitudes += (tuneMax - tuneMin) / 2;
       }
     }
+    tuneSwitch = now;
+    tuneMax = tuneMin = temp;
+    tuneHigh = false;
+    setDewPortLevel(tunePort, PWMMIN);
+  } else if ( !tuneHigh && temp < tuneTarget - TUNEHYST ) {
+    tuneHigh = true;
+    setDewPortLevel(tunePort, PWMMAX);
+  }
+
+  if ( tuneCycle > TUNECYCLES ) {
+    float period = tunePeriods / TUNECYCLES;
+    float amplitude = tuneAmplitudes / TUNECYCLES;
+    float ku = 2.0 * (PWMMAX - PWMMIN) / (PI * max(amplitude, 0.01F));
+
+    dew_t dew = getDew(index);
+
+    dew.kp = ku / 3.2;
+    dew.ki = dew.kp / (2.2 * period);
+    dew.kd = 0;
+    putDew(index, dew);
+    stopAutotune(tuneDone);
   }
 }
 
 
+// default dew heater control of every PWM port
+void setDefaultDew() {
+  const dew_t dew = { DEWPERIOD, KP, KI, KD };
+
+  for ( byte i=0; i < PWMPORTS; i++)
+    putDew(i, dew);
+}
+
+
 //-----------------------------------------------------------------------
 // Temperature probes discovery and helpers
 //-----------------------------------------------------------------------
@@ -522,7 +2065,7 @@ void discoverProbes(int muxPort) {
   // check for BME280 at address 0x76 (SDO pulled to GND)
   // the BME280 does humidity pressure and temp
   // if we have this one as native (muxPort = 255) we cannot have one muxed so lets check if we should skip it
-  if (!skip_76) {
+  if (!skip_76 && probeCount < MAXPROBES) {
     probeFound = bme.begin(0x76);
     if (probeFound) {
       DPRINTLN(F("found BME280_76"));
@@ -540,7 +2083,7 @@ void discoverProbes(int muxPort) {
   // check for BME280 at address 0x77 (native)
   // the BME280 does humidity pressure and temp
   // if we have this one as native (muxPort = 255) we cannot have one muxed so lets check if we should skip it
-  if (!skip_77) {
+  if (!skip_77 && probeCount < MAXPROBES) {
     probeFound = bme.begin(0x77);
     if (probeFound) {
       DPRINTLN(F("found BME280_76"));
@@ -559,7 +2102,7 @@ void discoverProbes(int muxPort) {
   // check for SHT3x sensor
   // the SHT3x is much more precise and reliable than the AHT10 but is also MUCH more expensive ~8$
   // if we have this one as native (muxPort = 255) we cannot have one muxed so lets check if we should skip it
-  if (!skip_44) {
+  if (!skip_44 && probeCount < MAXPROBES) {
     probeFound = sht31.begin(0x44);
     if (probeFound) {
       DPRINTLN(F("Found SHT3x_44"));
@@ -575,7 +2118,7 @@ void discoverProbes(int muxPort) {
   }
   // check for an SHT3x at the other address
   // if we have this one as native (muxPort = 255) we cannot have one muxed so lets check if we should skip it
-  if (!skip_45) {
+  if (!skip_45 && probeCount < MAXPROBES) {
     probeFound = sht31.begin(0x45); // 0x45 is an alternate address for the SHT31
     if (probeFound) {
       DPRINTLN(F("Found SHT3x_45"));
@@ -593,7 +2136,7 @@ void discoverProbes(int muxPort) {
   // check for AHT10
   // the AHT10 is cheap ~1$ but less reliable
   // if we have this one as native (muxPort = 255) we cannot have one muxed so lets check if we should skip it
-  if (!skip_10) {
+  if (!skip_10 && probeCount < MAXPROBES) {
     probeFound = aht10.begin();
     if (probeFound) {
       DPRINTLN(F("found AHT10"));
@@ -610,141 +2153,459 @@ void discoverProbes(int muxPort) {
 }
 
 
+//-----------------------------------------------------------------------
+// Loop timing
+//-----------------------------------------------------------------------
+void addTiming(timing_t &timing, unsigned long elapsed) {
+  unsigned int steps = elapsed / TIMESTEP > 0xFFFF ? 0xFFFF : elapsed / TIMESTEP;
+
+  if ( timing.count == 0 || steps < timing.min )
+    timing.min = steps;
+  if ( steps > timing.max )
+    timing.max = steps;
+  if ( timing.count == 0xFFFF || timing.total > 0x7FFFFFFFUL ) {
+    timing.count >>= 1;
+    timing.total >>= 1;
+  }
+  timing.count++;
+  timing.total += elapsed;
+}
+
+
+void timeProbe(byte probe, unsigned long elapsed) {
+  addTiming(probeTiming, elapsed);
+#ifdef TIMINGDETAIL
+  addTiming(probeDetail[probe], elapsed);
+#endif
+}
+
+
+void timeCommand(char cmd, unsigned long elapsed) {
+  addTiming(commandTiming, elapsed);
+#ifdef TIMINGDETAIL
+  // unknown letters share the last slot
+  const char *slot = cmd != '\0' ? strchr_P(timedCommands, cmd) : NULL;
+  addTiming(commandDetail[slot != NULL ? slot - timedCommands : TIMECOMMANDS - 1], elapsed);
+#endif
+}
+
+
+void sendTiming(const timing_t &timing) {
+  serialRoom(44);
+  Serial.print(':');
+  Serial.print(timing.count);
+  Serial.print(':');
+  Serial.print(timing.total);
+  Serial.print(':');
+  Serial.print((unsigned long)timing.min * TIMESTEP);
+  Serial.print(':');
+  Serial.print((unsigned long)timing.max * TIMESTEP);
+}
+
+
+// '>t:<loop gap>:<idle>:<read>:<dew>:<swap>:<probes>:<commands>#', with TIMINGDETAIL followed by
+// ':<each probe>:<letter>:<timing> of each command seen'
+// a timing is <count>:<total>:<min>:<max> in us, unknown commands are reported under '?'
+void sendTimings() {
+  DPRINTLN(F("- Send: timing"));
+  serialRoom(14);
+  Serial.print(F(">t:"));
+  Serial.print(loopGap);
+  for ( byte i = 0; i <= stateSwap; i++ )
+    sendTiming(stateTiming[i]);
+  sendTiming(probeTiming);
+  sendTiming(commandTiming);
+#ifdef TIMINGDETAIL
+  for ( int i = 0; i < probeCount; i++ )
+    sendTiming(probeDetail[i]);
+  for ( byte i = 0; i < TIMECOMMANDS; i++ ) {
+    if ( commandDetail[i].count == 0 )
+      continue;
+    serialRoom(2);
+    Serial.print(':');
+    Serial.print(i < TIMECOMMANDS - 1 ? (char)pgm_read_byte(&timedCommands[i]) : '?');
+    sendTiming(commandDetail[i]);
+  }
+#endif
+  Serial.print('#');
+}
+
+
+void clearTimings() {
+  memset(stateTiming, 0, sizeof(stateTiming));
+  memset(&probeTiming, 0, sizeof(probeTiming));
+  memset(&commandTiming, 0, sizeof(commandTiming));
+#ifdef TIMINGDETAIL
+  memset(probeDetail, 0, sizeof(probeDetail));
+  memset(commandDetail, 0, sizeof(commandDetail));
+#endif
+  loopGap = 0;
+}
+
+
 //-----------------------------------------------------------------------
 // Command processing
 //-----------------------------------------------------------------------
 void processSerialCommand() {
-  int cmdval;
   int port;
-  int level;
   int mode;
+  long milli;
+  long pre;
+  long trip;
+  long rated;
+  long budget;
+  fault_t *fault;
+  fuse_t fuse;
+  sequence_t sequence;
+  dew_t dew;
   char name[NAMELENGTH];
-  
-  String receiveString = "";
-  String optionString = "";
-  String replyString = "";
-  char replyChars[17];
+  char *command;
+  const char *args;
+  unsigned long start = micros();
 
   if ( queueCount == 0 )
     return;
-  receiveString = String(pop());
-  char cmd = receiveString[0];
+  // the command is parsed in place in its queue slot: the letter, then the colon separated fields
+  command = pop();
+  char cmd = command[0];
+  args = cmd != '\0' && command[1] == ':' ? command + 2 : command + strlen(command);
   #ifdef DEBUG
   DPRINT(F("- rcv str="));
-  DPRINTLN(receiveString);
+  DPRINTLN(command);
   DPRINT(F("- cmd="));
   DPRINTLN(cmd);
   #endif
   switch (cmd)
   {
     case 'P':       // Ping commmand '>P#', respond with '>POK#'
-      sendPacket(">POK#");
+      // a ping at the new rate confirms a b command switch
+      baudPending = false;
+      sendPacket(F(">POK#"));
       break;
     case 'D':       // Discover command '>D#', respond with boardSignature and versions
-      replyString += ">D:";
-      replyString += programName;
-      replyString += ":";
-      replyString += programVersion;
-      replyString += ":";
-      replyString += boardSignature;
-      replyString += "#";
-      sendPacket(replyString);
+      sendDescription();
+      break;
+    case 'd':       // configuration dump '>d#', return the signature, port names, PWM port settings and probe map in one reply
+      sendDump();
       break;
     case 'S':       // Status command '>S#', return a formatted string with all currents and voltages as well as a port bitmap
-      getStatusString();
-      replyString += ">S:";
-      replyString += status;
-      replyString += "#";
-      sendPacket(replyString);
+      sendStatus();
       break;
     case 'N':       // get port n name command '>N:nn#'
-      optionString = receiveString.substring(2, receiveString.length());
-      port = (int)optionString.toInt();
+      port = (int)nextField(args);
+      if ( port < 0 || port >= PORTNUM ) {
+        sendPacket(F(">NERR#"));
+        break;
+      }
       EEPROM.get(port * NAMELENGTH, name);
-      sprintf(replyChars, ">N:%02d:%s#", port, name);
-      sendPacket(replyChars);
+      name[NAMELENGTH - 1] = '\0';
+      sprintf_P(reply, PSTR(">N:%02d:%s#"), port, name);
+      sendPacket(reply);
       break;
     case 'M':       // set port n name s command '>M:nn:s#'
-      optionString = receiveString.substring(2, receiveString.indexOf(":",3));
-      port = (int)optionString.toInt();
+      port = (int)nextField(args);
       DPRINT(F("- port="));
       DPRINTLN(port);
-      optionString = receiveString.substring(receiveString.indexOf(":",3) + 1, receiveString.length());
       DPRINT(F("- workstr="));
-      DPRINTLN(optionString);
-      writeNameToEEPROM(port, optionString);
-      sendPacket(">MOK#");
+      DPRINTLN(args);
+      if ( port < 0 || port >= PORTNUM ) {
+        sendPacket(F(">MERR#"));
+        break;
+      }
+      writeNameToEEPROM(port, args);
+      sendPacket(F(">MOK#"));
       break;
     case 'O':       // Set switch port n ON command '>O:nn#', return OK
-      optionString = receiveString.substring(2, receiveString.length());
-      port = (int)optionString.toInt();
+      port = (int)nextField(args);
       switchPortOn(port);
-      sendPacket(">OOK#");
+      sendPacket(F(">OOK#"));
       break;
     case 'F':       // Set swithport n OFF command '>F:nn#', return OK
-      optionString = receiveString.substring(2, receiveString.length());
-      port = (int)optionString.toInt();
+      port = (int)nextField(args);
       switchPortOff(port);
-      sendPacket(">FOK#");
+      sendPacket(F(">FOK#"));
       break;
     case 'W':       // set PWM port n level n command '>W:nn:l#', return OK
-      optionString = receiveString.substring(2, receiveString.indexOf(":",3));
-      port = (int)optionString.toInt();
-      optionString = receiveString.substring(receiveString.indexOf(":",3) + 1, receiveString.length());
-      level = (int)optionString.toInt();
-      setPWMPortLevel(port, level);
-      sendPacket(">WOK#");
+      port = (int)nextField(args);
+      setPWMPortLevel(port, (int)nextField(args));
+      sendPacket(F(">WOK#"));
       break;
     case 'C':       // configure PWM port mode command '>C:nn:m#', return OK
-      optionString = receiveString.substring(2, receiveString.indexOf(":",3));
-      port = (int)optionString.toInt();
-      optionString = receiveString.substring(receiveString.indexOf(":",3) + 1, receiveString.length());
-      mode = (int)optionString.toInt();
-      powerBoxConf.pwmPortMode[port - boardSignature.indexOf("p")] = byte(mode);
-      sendPacket(">COK#");
+      port = (int)nextField(args);
+      if ( port < FIRSTPWM || port >= FIRSTPWM + PWMPORTS ) {
+        sendPacket(F(">CERR#"));
+        break;
+      }
+      powerBoxConf.pwmPortMode[port - FIRSTPWM] = byte(nextField(args));
+      sendPacket(F(">COK#"));
       writeConfigToEEPROM();
       break;
     case 'G':       // get PWM port mode command '>G:nn#', return '>G:nn:m#'
-      optionString = receiveString.substring(2, receiveString.indexOf(":",3));
-      port = (int)optionString.toInt();
-      mode = int(powerBoxConf.pwmPortMode[port - boardSignature.indexOf("p")]);
+      port = (int)nextField(args);
+      if ( port < FIRSTPWM || port >= FIRSTPWM + PWMPORTS ) {
+        sendPacket(F(">GERR#"));
+        break;
+      }
+      mode = int(powerBoxConf.pwmPortMode[port - FIRSTPWM]);
       if ( mode < 0 || mode > 3 ) {
-        powerBoxConf.pwmPortMode[port - boardSignature.indexOf("p")] = byte(variable);
+        powerBoxConf.pwmPortMode[port - FIRSTPWM] = byte(variable);
         mode = byte(variable);
       }
-      sprintf(replyChars, ">G:%02d:%d#", port, mode);
-      sendPacket(replyChars);
+      sprintf_P(reply, PSTR(">G:%02d:%d#"), port, mode);
+      sendPacket(reply);
       break;
     case 'T':       // configure PWM port temp offset command '>T:nn:m#', return OK
-      optionString = receiveString.substring(2, receiveString.indexOf(":",3));
-      port = (int)optionString.toInt();
-      optionString = receiveString.substring(receiveString.indexOf(":",3) + 1, receiveString.length());
-      mode = (int)optionString.toInt();
-      powerBoxConf.pwmPortTempOffset[port - boardSignature.indexOf("p")] = byte(mode);
-      sendPacket(">TOK#");
+      port = (int)nextField(args);
+      if ( port < FIRSTPWM || port >= FIRSTPWM + PWMPORTS ) {
+        sendPacket(F(">TERR#"));
+        break;
+      }
+      powerBoxConf.pwmPortTempOffset[port - FIRSTPWM] = byte(nextField(args));
+      sendPacket(F(">TOK#"));
       writeConfigToEEPROM();
       break;
     case 'H':       // get PWM port temp Offset command '>H:nn#', return '>H:nn:m#'
-      optionString = receiveString.substring(2, receiveString.indexOf(":",3));
-      port = (int)optionString.toInt();
-      mode = int(powerBoxConf.pwmPortTempOffset[port - boardSignature.indexOf("p")]);
-      sprintf(replyChars, ">H:%02d:%d#", port, mode);
-      sendPacket(replyChars);
+      port = (int)nextField(args);
+      if ( port < FIRSTPWM || port >= FIRSTPWM + PWMPORTS ) {
+        sendPacket(F(">HERR#"));
+        break;
+      }
+      mode = int(powerBoxConf.pwmPortTempOffset[port - FIRSTPWM]);
+      sprintf_P(reply, PSTR(">H:%02d:%d#"), port, mode);
+      sendPacket(reply);
+      break;
+    case 'K':       // calibrate channel n against a known load of m mA (mV for the input voltage) '>K:nn:m#', return OK or ERR
+      port = (int)nextField(args);
+      milli = nextField(args);
+      // a scope capture holds the current sense
+      if ( port < 0 || port >= CALCHANNELS || scopeBusy() ) {
+        sendPacket(F(">KERR#"));
+        break;
+      }
+      calibrateChannel(port, milli);
+      sendPacket(F(">KOK#"));
+      break;
+    case 'L':       // get channel n calibration command '>L:nn#', return '>L:nn:gain:offset#' or ERR
+      port = (int)nextField(args);
+      if ( port < 0 || port >= CALCHANNELS ) {
+        sendPacket(F(">LERR#"));
+        break;
+      }
+      sprintf_P(reply, PSTR(">L:%02d:%ld:%ld#"), port, powerBoxCal[port].gain, powerBoxCal[port].offset);
+      sendPacket(reply);
+      break;
+    case 'Y':       // fault log, '>Y#' returns the number of faults and the worst latency '>Y:n:us#', '>Y:nn#' returns fault nn, 00 is the latest
+      if ( *args == '\0' ) {
+        sprintf_P(reply, PSTR(">Y:%u:%lu#"), faultCount, faultWorst);
+        sendPacket(reply);
+        break;
+      }
+      port = (int)nextField(args);
+      if ( port < 0 || port >= FAULTLOGSIZE || (unsigned int)port >= faultCount )
+        break;
+      fault = &faultLog[(faultCount - 1 - port) % FAULTLOGSIZE];
+      sprintf_P(reply, PSTR(">Y:%02d:%d:%d:%ld:%lu:%lu#"), port, fault->cause, fault->port, fault->value, fault->latency, fault->time);
+      sendPacket(reply);
+      break;
+    case 'I':       // set port n fuse '>I:nn:trip:rated:i2t#', trip and rated in mA, i2t in A2s, return OK or ERR
+      port = (int)nextField(args);
+      trip = nextField(args);
+      rated = nextField(args);
+      budget = nextField(args);
+      // a trip at or below the rated current or an empty budget would cut the port as soon as it draws anything
+      if ( port < 0 || port >= PORTNUM || rated <= 0 || trip <= rated || trip > 65535L || budget <= 0 || budget > 65535L ) {
+        sendPacket(F(">IERR#"));
+        break;
+      }
+      fuse.trip = trip;
+      fuse.rated = rated;
+      fuse.i2t = budget;
+      putFuse(port, fuse);
+      updateTripLevels();
+      sendPacket(F(">IOK#"));
+      break;
+    case 'J':       // get port n fuse '>J:nn#', return '>J:nn:trip:rated:i2t#'
+      port = (int)nextField(args);
+      if ( port < 0 || port >= PORTNUM )
+        break;
+      fuse = getFuse(port);
+      sprintf_P(reply, PSTR(">J:%02d:%u:%u:%u#"), port, fuse.trip, fuse.rated, fuse.i2t);
+      sendPacket(reply);
+      break;
+    case 'Q':       // set port n power-on sequence '>Q:nn:priority:wait#', wait in ms, return OK
+      port = (int)nextField(args);
+      if ( port >= 0 && port < PORTNUM ) {
+        sequence.priority = nextField(args);
+        sequence.wait = nextField(args);
+        putSequence(port, sequence);
+      }
+      sendPacket(F(">QOK#"));
+      break;
+    case 'R':       // get port n power-on sequence '>R:nn#', return '>R:nn:priority:wait#'
+      port = (int)nextField(args);
+      if ( port < 0 || port >= PORTNUM )
+        break;
+      sequence = getSequence(port);
+      sprintf_P(reply, PSTR(">R:%02d:%d:%u#"), port, sequence.priority, sequence.wait);
+      sendPacket(reply);
+      break;
+    case 'U':       // set scalar setting n '>U:nn:value#', return OK or ERR
+      mode = (int)nextField(args);
+      if ( mode >= 0 && mode < PARAMS ) {
+        milli = nextField(args);
+        if ( !validParams(mode, milli) ) {
+          sendPacket(F(">UERR#"));
+          break;
+        }
+        putParam(mode, milli);
+        // a new battery starts over from its rest voltage
+        if ( mode == PARAMCAPACITY )
+          batteryCharge = -1;
+        if ( mode == PARAMPWMPHASE )
+          setupPwm();
+      }
+      sendPacket(F(">UOK#"));
+      break;
+    case 'V':       // get scalar setting n '>V:nn#', return '>V:nn:value#'
+      mode = (int)nextField(args);
+      if ( mode < 0 || mode >= PARAMS )
+        break;
+      sprintf_P(reply, PSTR(">V:%02d:%ld#"), mode, getParam(mode));
+      sendPacket(reply);
+      break;
+    case 'A':       // set PWM port n dew control '>A:nn:period:kp:ki:kd#', period in s, gains in thousandths, return OK
+      port = (int)nextField(args);
+      if ( port >= FIRSTPWM && port < FIRSTPWM + PWMPORTS ) {
+        dew.period = max(nextField(args), 1L);
+        dew.kp = nextField(args) / 1000.0;
+        dew.ki = nextField(args) / 1000.0;
+        dew.kd = nextField(args) / 1000.0;
+        dewIntegral[port - FIRSTPWM] = 0;
+        putDew(port - FIRSTPWM, dew);
+      }
+      sendPacket(F(">AOK#"));
+      break;
+    case 'B':       // get PWM port n dew control '>B:nn#', return '>B:nn:period:kp:ki:kd:output:error#', error in hundredths of C
+      port = (int)nextField(args);
+      if ( port < FIRSTPWM || port >= FIRSTPWM + PWMPORTS )
+        break;
+      dew = getDew(port - FIRSTPWM);
+      sprintf_P(reply, PSTR(">B:%02d:%u:%ld:%ld:%ld:%d:%ld#"), port, dew.period,
+        fixRound(dew.kp * 1000), fixRound(dew.ki * 1000), fixRound(dew.kd * 1000), dewLevel[port - FIRSTPWM], fixRound(dewError[port - FIRSTPWM] * 100));
+      sendPacket(reply);
+      break;
+    case 'X':       // start the auto-tune of PWM port n '>X:nn#', abort it '>X#', return OK
+      if ( tuneState == tuneRunning )
+        stopAutotune(tuneIdle);
+      if ( *args != '\0' )
+        startAutotune((byte)nextField(args));
+      sendPacket(F(">XOK#"));
+      break;
+    case 'Z':       // auto-tune status, return '>Z:nn:state:cycle:period:amplitude#', period in s, amplitude in hundredths of C
+      sprintf_P(reply, PSTR(">Z:%02d:%d:%d:%ld:%ld#"), tunePort, tuneState, tuneCycle,
+        tuneCycle > 1 ? fixRound(tunePeriods / (tuneCycle - 1)) : 0L, tuneCycle > 1 ? fixRound(tuneAmplitudes * 100 / (tuneCycle - 1)) : 0L);
+      sendPacket(reply);
+      break;
+    case 'f':       // set PWM timer t frequency '>f:t:clock:bits#', t is 1 or 2, clock 0 leaves it to the PWM engine, return OK
+      mode = (int)nextField(args);
+      if ( mode == 1 || mode == 2 ) {
+        byte timer = mode == 1 ? PWMTIMER1 : PWMTIMER2;
+        unsigned long top = timerTop(PWMTIMER1);
+        powerBoxConf.pwmClock[timer] = constrain(nextField(args), 0, timer == PWMTIMER1 ? 5 : 7);
+        if ( timer == PWMTIMER1 ) {
+          powerBoxConf.pwmBits = constrain(nextField(args), 8, 16);
+          // keep the duty of the fine level at the new resolution, it must never be above ICR1
+          powerBoxConf.pwmFine = min((unsigned long)powerBoxConf.pwmFine * timerTop(PWMTIMER1) / top, (unsigned long)timerTop(PWMTIMER1));
+        }
+        setupPwm();
+        writeConfigToEEPROM();
+      }
+      sendPacket(F(">fOK#"));
+      break;
+    case 'g':       // get PWM timer t frequency '>g:t#', return '>g:t:clock:bits:hz#'
+      mode = (int)nextField(args);
+      if ( mode != 1 && mode != 2 )
+        break;
+      sprintf_P(reply, PSTR(">g:%d:%d:%d:%ld#"), mode, powerBoxConf.pwmClock[mode == 1 ? PWMTIMER1 : PWMTIMER2],
+        mode == 1 ? powerBoxConf.pwmBits : 8, timerHertz(mode == 1 ? PWMTIMER1 : PWMTIMER2));
+      sendPacket(reply);
+      break;
+    case 'w':       // set the Timer1 port level at the Timer1 resolution '>w:nn:level#', return OK
+      port = (int)nextField(args);
+      if ( port >= FIRSTPWM && port < FIRSTPWM + PWMPORTS && portPin(port) == TIMER1PIN ) {
+        powerBoxConf.pwmFine = constrain(nextField(args), 0L, (long)timerTop(PWMTIMER1));
+        setPWMPortLevel(port, coarseLevel(powerBoxConf.pwmFine));
+      }
+      sendPacket(F(">wOK#"));
+      break;
+    case 'b':       // switch the serial rate '>b:baud#', return '>b:baud#' at the old rate with the rate now in use
+      // the host then pings at the new rate within BAUDVERIFY ms or the link falls back to SERIALPORTSPEED
+      milli = nextField(args);
+      if ( validBaud(milli) ) {
+        sprintf_P(reply, PSTR(">b:%ld#"), milli);
+        sendPacket(reply);
+        switchBaud(milli);
+        baudPending = true;
+        baudStamp = millis();
+      } else {
+        sprintf_P(reply, PSTR(">b:%ld#"), serialBaud);
+        sendPacket(reply);
+      }
+      break;
+    case 'E':       // extended status '>E#', return '>E:<blown fuses>:<sequence peak mA>:<shed ports>:<heater throttle>:<low voltage>:<charge %>:<peak mA>:<RMS mA>#'
+      sprintf_P(reply, PSTR(">E:%u:%ld:%u:%d:%d:%d:%ld:%ld#"), fuseBlown, seqPeak, shedPorts, shedThrottle, lowVoltage, batterySoc, ripplePeak, rippleRms);
+      sendPacket(reply);
+      break;
+    case 'h':       // telemetry history '>h#', return the history ring in one binary burst, '>h:0#' empties it and returns OK
+      if ( *args == '\0' ) {
+        sendHistory();
+        break;
+      }
+      clearHistory();
+      sendPacket(F(">hOK#"));
+      break;
+    case 'c':       // scope capture '>c:nn:inputs:trigger:pre:decimate#' starts it and returns OK, '>c#' returns its state then the capture
+      if ( *args == '\0' ) {
+        sendScope();
+        break;
+      }
+      port = (int)nextField(args);
+      mode = (int)nextField(args);
+      milli = nextField(args);
+      pre = nextField(args);
+      if ( startScope(port, mode, milli, pre, nextField(args)) )
+        sendPacket(F(">cOK#"));
+      else
+        sendPacket(F(">cERR#"));
+      break;
+    case 't':       // loop timing '>t#', return the timing of the FSM states, probe reads and commands, '>t:0#' clears it and returns OK
+      if ( *args == '\0' ) {
+        sendTimings();
+        break;
+      }
+      clearTimings();
+      sendPacket(F(">tOK#"));
       break;
     default:
       break;
   }
+  timeCommand(cmd, micros() - start);
+#ifdef BENCHMARK
+  // debug output only, a host parsing the replies would read these lines as garbage
+  DPRINT(F("- cmd "));
+  DPRINT(cmd);
+  DPRINT(F(" cycles="));
+  DPRINTLN((micros() - start) * clockCyclesPerMicrosecond());
+#endif
 }
 
 
 void setup() {
   DPRINTLN("Setup Start");
-  status.reserve(STATUSSIZE);
-  boardSignature.reserve(boardSignature.length() + 5);
-  // prereserve the queue
-  for ( int i=0; i < QUEUELENGTH; i++)
-    queue[i] = (char*)malloc(MAXCOMMAND);
-  line.reserve(MAXCOMMAND);
+  // the port part of the signature comes from the board description, probes get appended during discovery
+  boardSignature.reserve(PORTNUM + MAXPROBES);
+  for ( byte i=0; i < PORTNUM; i++)
+    boardSignature += portKind(i);
 
   // initialize all of our hardware first
   // initialize serial port
@@ -752,9 +2613,8 @@ void setup() {
   // clear any garbage from serial buffer
   clearSerialPort();
 
-  // initialize the MCP27017
-  if ( boardSignature.indexOf('m') != -1 ) 
-    mcp.begin_I2C();
+  // initialize the MCP27017, this is a no-op on boards without 'm' ports
+  mcp.begin();
 
   // initialize the status struct to 0
   memset(&powerBoxStatus, 0, sizeof(powerBoxStatus));
@@ -794,26 +2654,14 @@ void setup() {
   }
   DPRINTLN(F(" Done"));
 
-  //----- PWM frequency for D3 & D11 -----
-  // may be usefull to drive flat panels
-  // TODO: create a command to enable this
-  //Timer2 divisor = 2, 16, 64, 128, 512, 2048
-  //TCCR2B = TCCR2B & B11111000 | B00000001;    // 31KHz
-  //TCCR2B = TCCR2B & B11111000 | B00000010;    // 3.9KHz
-  //TCCR2B = TCCR2B & B11111000 | B00000011;    // 980Hz
-  //TCCR2B = TCCR2B & B11111000 | B00000100;    // 490Hz (default)
-  //TCCR2B = TCCR2B & B11111000 | B00000101;    // 245Hz
-  //TCCR2B = TCCR2B & B11111000 | B00000110;    // 122.5Hz
-  //TCCR2B = TCCR2B & B11111000 | B00000111;    // 30.6Hz
+  // the PWM frequencies (Timer2 on D3, Timer1 on D9) are set from the config by setupPwm() once the settings are loaded
 
   // initialize pins
-  for ( int i=0; i < boardSignature.length(); i++) {
-    if (boardSignature[i] == 'm')
-      mcp.pinMode(ports2Pin[i], OUTPUT);
-    if (boardSignature[i] == 's')
-      pinMode(ports2Pin[i], OUTPUT);
-    if (boardSignature[i] == 'p')
-      pinMode(ports2Pin[i], OUTPUT);
+  for ( byte i=0; i < PORTNUM; i++) {
+    if (portKind(i) == 'm')
+      mcp.pinMode(portPin(i), OUTPUT);
+    if (portKind(i) == 's' || portKind(i) == 'p')
+      pinMode(portPin(i), OUTPUT);
   }
   pinMode(ISIN, INPUT);
   pinMode(VSIN, INPUT);
@@ -826,19 +2674,16 @@ void setup() {
   
   // enable Open Load detection by default
   digitalWrite(OLEN, HIGH);
-  // set the diag to chip 1 and DSEL to High ( lower order ports are DSEL HIGH)
-  digitalWrite(MUX0, LOW);
-  digitalWrite(MUX1, LOW);
-  digitalWrite(MUX2, LOW);
-  digitalWrite(DSEL, dsel);
+  // point the current sense at the first port
+  selectSense(0);
 
   // find a valid config
   // we're not allways writing to the same location and kill the EEPROM
   // so we need to find the last place we stored the config
   bool found = false;
-  for ( int addr=EEPROMCONFBASE; addr < EEPROM.length(); addr = addr + sizeof(config_t)) {
+  for ( int addr=EEPROMCONFBASE; addr + sizeof(config_t) <= EEPROMSETBASE; addr = addr + sizeof(config_t)) {
     EEPROM.get(addr, powerBoxConf);
-    if ( powerBoxConf.currentData == CURRENTCONFIGFLAG ) {
+    if ( powerBoxConf.currentData == CURRENTCONFIGFLAG && powerBoxConf.version == CONFIGVERSION ) {
       DPRINT(F("- Valid config at="));
       DPRINTLN(addr);
       found = true;
@@ -846,19 +2691,15 @@ void setup() {
       break;
     }
   }
-  if ( found ) {
-    // restore ports per config
-    DPRINT(F("- PortStatus="));
-    DPRINTLN(powerBoxConf.portStatus);
-    for ( int i=0; i < 8; i++)
-      mcp.digitalWrite(ports2Pin[i], bitRead(powerBoxConf.portStatus, i));
-    // PWM port duty cycles
-    for ( int i=0; i < sizeof(powerBoxConf.pwmPorts); i++)
-      analogWrite(ports2Pin[i], powerBoxConf.pwmPorts[i]);
-
-  } else {
+  if ( !found )
     setDefaults();
+  // the timers only take the clocks the f command allows, timer 1 clocks 6 and 7 would count the T1 pin
+  if ( powerBoxConf.pwmClock[PWMTIMER1] > 5 || powerBoxConf.pwmClock[PWMTIMER2] > 7 ) {
+    powerBoxConf.pwmClock[PWMTIMER1] = 0;
+    powerBoxConf.pwmClock[PWMTIMER2] = 0;
   }
+  powerBoxConf.pwmBits = constrain(powerBoxConf.pwmBits, 8, 16);
+  powerBoxConf.pwmFine = min(powerBoxConf.pwmFine, timerTop(PWMTIMER1));
 
   // initialize our delays
   now = millis();
@@ -866,30 +2707,57 @@ void setup() {
   lastm = now;
 
   portIndex = 0;
-  portMax = sizeof(powerBoxStatus.portAmps) / sizeof(float);
-
-  // initialize the PID controllers even if we don't use themn
-  for (int i=0; i < 4; i++) {
-    pid[i].begin();          // initialize the PID instance
-    pid[i].tune(KP, KI, KD);       // Tune the PID, arguments: kP, kI, kD
-    pid[i].limit(0, 255);
-  }
+  loadSettings();
+  updateTripLevels();
+  startSampling();
+  // start the filters from a reading so the low voltage disconnect does not see a ramp from 0V
+  filteredVolts = applyCal(powerBoxCal[CALINVOLTS], nextSample(ADCVIN));
+  filteredAmps = applyCal(powerBoxCal[CALINAMPS], nextSample(ADCIIN));
+  setupPwm();
+  // restore ports per config, once the settings holding their power-on sequence are loaded
+  DPRINT(F("- PortStatus="));
+  DPRINTLN(powerBoxConf.portStatus);
+  restorePorts();
+#ifdef BENCHMARK
+  benchmarkSampling();
+#endif
 
   DPRINTLN("Setup done");
-
+  // tell a host waiting on the reset caused by opening the port that we are ready
+  sendDescription();
 }
 
 
 void loop() {
   static byte FSMState = stateIdle;
-  
+  unsigned long start = micros();
+  unsigned long probeStart;
+  byte state;
+
+  if ( loopStamp != 0 && start - loopStamp > loopGap )
+    loopGap = start - loopStamp;
+  loopStamp = start;
+  // a trip raised by the ADC interrupt comes before anything else
+  serviceFault();
+  runSequencer();
+  runHistory();
+  runScope();
+  checkBaud();
   if ( queueCount >= 1 )                 // check for serial command
   {
     processSerialCommand();
+    serviceFault();
   }
+  state = FSMState;
+  start = micros();
   switch (FSMState)
   {
     case stateIdle:
+      // write a config changed by the fault path
+      if ( configDirty ) {
+        configDirty = false;
+        writeConfigToEEPROM();
+      }
       // wait REFRESH milliseconds between Read cycles
       now = millis();
       if ( now > last + REFRESH )
@@ -901,27 +2769,19 @@ void loop() {
     case stateRead:
       // lets read the values on our Analog ports
       // first the input
-      // equations are given by the hardware implementation and the datasheets
-      // to be truly modular (ie have the board.h be the SoT for the HW implementation)
-      // we should use macros defined board.h
-      powerBoxStatus.inputVolts = (( analogRead(VSIN) * (VCC / 1023.0) ) * RDIVIN ) / RDIVOUT;
-      powerBoxStatus.inputAmps = (( analogRead(ISIN) * (VCC / 1023.0) ) - (VCC/2)) * 1000.0 / KINIS;
-      // if input is above MAXINVOLTS then we need to shutdown power to all downstreams
-      if ( powerBoxStatus.inputVolts > MAXINVOLTS )
-        shutdownAllPorts();
-      // next read the output current for the current port
-      switch ( boardSignature[portIndex] ) {
-        case 's':
-        case 'm':
-        case 'p':
-          powerBoxStatus.portAmps[portIndex] = ( analogRead(ISOUT) * (VCC / 1023.0) ) * KILIS / ROUTIS;
-          break;
-        case 'a':
-          powerBoxStatus.portAmps[portIndex] = (( analogRead(ISOUT) * (VCC / 1023.0)) - (VCC/2)) * 1000.0 / KOUTIS;
-          break;
-        default:
-          break;
-      }
+      // equations are given by the hardware implementation and the datasheets, they are
+      // folded into the integer calibration of each channel so there is no float math here
+      // the readings come from the ADC interrupt which also takes care of the over voltage and over current cut
+      powerBoxStatus.inputVolts = applyCal(powerBoxCal[CALINVOLTS], latestSample(ADCVIN));
+      powerBoxStatus.inputAmps = applyCal(powerBoxCal[CALINAMPS], latestSample(ADCIIN));
+      filteredAmps += (powerBoxStatus.inputAmps - filteredAmps) / SHEDFILTER;
+      filteredVolts += (powerBoxStatus.inputVolts - filteredVolts) / SHEDFILTER;
+      checkLoad();
+      updateCharge();
+      updateRipple();
+      // next read the output current for the current port, its calibration carries the sensor type
+      powerBoxStatus.portAmps[portIndex] = applyCal(powerBoxCal[portIndex], latestSample(ADCIOUT));
+      checkFuse(portIndex);
 
 #ifdef DEBUG
       //char buf[50];
@@ -941,11 +2801,12 @@ void loop() {
       break;
 
     case stateDew:
-      // adjust PWM ports for dew heater control, do this every minute only
+      // read the probes every SENSORITVL seconds, the dew heater control has its own period per port
       now = millis();
-      if ( now > lastm + (TEMPITVL * 60000) ) {
+      if ( now > lastm + (SENSORITVL * 1000L) ) {
         // get temp and humidity
         if ( haveTemp ) {
+          probeStart = micros();
           switch (powerBoxStatus.tempProbeType[0]) {
             case SHT31_0x44:
               sht31.begin(0x44);
@@ -975,46 +2836,59 @@ void loop() {
               powerBoxStatus.pressure = bme.readPressure() / 100.00F;
               break;
           }
+          timeProbe(0, micros() - probeStart);
+          serviceFault();
           powerBoxStatus.tempProbe[0] = powerBoxStatus.temp;
-          powerBoxStatus.dewpoint = powerBoxStatus.temp - ((100 - powerBoxStatus.humid) / 5);
+          powerBoxStatus.dewpoint = magnusDewpoint(powerBoxStatus.temp, powerBoxStatus.humid);
+          powerBoxStatus.dewpointProbe[0] = powerBoxStatus.dewpoint;
 
           // cycle through the other sensors to get the temperatures for the PWM ports
+          // a probe that also reads humidity gets its own dewpoint, otherwise it takes the reference one
           for ( int i = 1 ; i < probeCount ; i++ ) {
+            float probeHumid = NAN;
+            probeStart = micros();
             imux.setPort(powerBoxStatus.tempProbePort[i]);
             switch (powerBoxStatus.tempProbeType[i]) {
               case SHT31_0x44:
                 sht31.begin(0x44);
-                powerBoxStatus.tempProbe[i] = sht31.readTemperature();
+                sht31.readBoth(&powerBoxStatus.tempProbe[i], &probeHumid);
                 break;
               case SHT31_0x45:
                 sht31.begin(0x45);
-                powerBoxStatus.tempProbe[i] = sht31.readTemperature();
+                sht31.readBoth(&powerBoxStatus.tempProbe[i], &probeHumid);
                 break;
               case AHT10:
                 sensors_event_t temp;
                 sensors_event_t humid;
                 aht10.getEvent(&humid, &temp);
                 powerBoxStatus.tempProbe[i] = temp.temperature;
+                probeHumid = humid.relative_humidity;
                 break;
               case BME280_0x76:
                 bme.begin(0x76);
                 powerBoxStatus.tempProbe[i] = bme.readTemperature();
+                probeHumid = bme.readHumidity();
                 break;
               case BME280_0x77:
                 bme.begin(0x77);
                 powerBoxStatus.tempProbe[i] = bme.readTemperature();
+                probeHumid = bme.readHumidity();
                 break;
             }
+            timeProbe(i, micros() - probeStart);
+            serviceFault();
+            powerBoxStatus.dewpointProbe[i] = isnan(probeHumid) ? powerBoxStatus.dewpoint : magnusDewpoint(powerBoxStatus.tempProbe[i], probeHumid);
           }
         }
 #ifdef DEBUG
         DPRINT(F(" Status: "));
-        getStatusString();
-        DPRINTLN(status);
+        sendStatus();
+        DPRINTLN();
 #endif
-        adjustDewHeaters();
+        runAutotune();
         lastm = now;
       }
+      adjustDewHeaters();
       FSMState = stateSwap;
       break;
 
@@ -1028,5 +2902,6 @@ void loop() {
       FSMState = stateIdle;
       break;
   }
-
+  if ( state <= stateSwap )
+    addTiming(stateTiming[state], micros() - start);
 }
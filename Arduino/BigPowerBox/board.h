@@ -7,6 +7,8 @@
 #define board_h
 
 #include <Arduino.h>
+#include <avr/pgmspace.h>
+#include <Adafruit_MCP23X17.h>
 #include "mydefines.h"
 
 // Board signature
@@ -20,60 +22,10 @@
 //  f: temp + humidity probe
 //  g: temp + humid + press probe
 // always-on ports always last followed by t then h
-String boardSignature = "mmmmmmmmppppaa";
+// the port part of the signature is generated from boardPorts[] below, the probes are appended at boot
+String boardSignature;
 // status string
 // 0:0:0:0:0:0:0:0:127:255:195:100:1:1:15.54:15.49:15.42:15.37:15.44:15.49:15.54:15.49:15.39:15.49:15.44:15.37:10.22:10.23:10.07:13.37:-10.00:100.00:-10.00
-#define STATUSSIZE      200             // size of thebuffer to hold the status line
-
-//-----------------------------------------------------------------------
-// EEPROM structures
-//-----------------------------------------------------------------------
-//      0       7  15
-//      -------------
-//    0|PORTNAME 1   |
-//   16|PORTNAME 2   |
-//    ....
-//  208|PORTNAME 14  |
-//  224|-------------|
-//  ...| config      |
-//  ...| space       |
-// 1013|             |
-//     ---------------
-
-// there are 2 types of config values we want to store in EEPROM
-// the first struct is rarely modified so it will live in the first 224 bytes of the EEPROM
-// we believe that these will be seldom modified so we can live with the 100k writes 
-// limitation of the EEPROM
-// Configuration struct to store long lived configs in EEPROM
-
-// The second struct will be modified at each change of a port status so might happen a couple
-// times per session. This struct will use the remaining EEPROM space and be written at a
-// differnet address of that space at each write. validdata will be chosen so that it has a
-// low probability of collisions with other values in the struct.
-// Configuration struct to store regularly changed configs in EEPROM
-// Struct is 6 bytes long
-// IMPROVE: do a dynamic declaration of this struct by using BoardSignature and making portPwm an array
-struct config_t {
-  byte  currentData;                      // if this is CURRENTCONFIGFLAG then data is valid
-  byte  portStatus;                       // bitmap of all port statuses (0: Off, 1: On)
-  byte  pwmPorts[4];                      // pwm value of ports 9-12 (0: Off, 255: On or 1: On if port in 's' mode)
-  byte  pwmPortMode[4];                   // operation mode of the PWM ports (enum PWMModes)
-  byte  pwmPortPreset[4];                 // last max value of the port, allows to store a preset
-  byte  pwmPortTempOffset[4];             // adjustable temperature offset for the PWM port in mode 3
-};
-
-struct status_t {
-    float portAmps[14];                   // size of array must be equal to boardSignature.length() this holds the current for each port
-    float inputAmps;
-    float inputVolts;
-    float temp;
-    float humid;
-    float dewpoint;
-    float pressure;
-    float tempProbe[5];                   // tempearture reading in C.
-    byte  tempProbePort[5];               // i2c muc port on which the probe is found, 255 is used for non mux.
-    byte  tempProbeType[5];               // type of probe found. limit them to 5 more would be overkill, like 640k RAM
-};
 
 //-----------------------------------------------------------------------
 // Digital output pins
@@ -94,7 +46,14 @@ struct status_t {
 #define PORT11EN            6             // D6 PWM port 11
 #define PORT12EN            9             // D9 PWM port 12
 
-const byte ports2Pin[12] = {PORT1EN, PORT2EN, PORT3EN, PORT4EN, PORT5EN, PORT6EN, PORT7EN, PORT8EN, PORT9EN, PORT10EN, PORT11EN, PORT12EN};
+// Always-On ports have no output
+#define NOPIN               255
+
+// PWM timers whose frequency can be set, Timer0 (D5 and D6) also runs millis() and is left alone
+#define PWMTIMER2           0             // Timer2, 8 bit, drives D3
+#define PWMTIMER1           1             // Timer1, up to 16 bit, drives D9
+#define PWMTIMERS           2
+#define TIMER1PIN           9             // OC1A, the only PWM output on a 16 bit timer
 
 //-----------------------------------------------------------------------
 // Analog Input pins
@@ -137,15 +96,250 @@ const byte ports2Pin[12] = {PORT1EN, PORT2EN, PORT3EN, PORT4EN, PORT5EN, PORT6EN
 #define KOUTIS              200.0         // multiplication factor for CC6900-10A in mV/A
 #define RDIVIN              14100.0       // total summ of all voltage divider resistors
 #define RDIVOUT             4700.0        // resitance of the output resitor of the voltage divider
-#define PORT1ON             1             // 00000001 1
-#define PORT2ON             2             // 00000010 2
-#define PORT3ON             4             // 00000100 4
-#define PORT4ON             8             // 00001000 8
-#define PORT5ON             16            // 00010000 16
-#define PORT6ON             32            // 00100000 32
-#define PORT7ON             64            // 01000000 64
-#define PORT8ON             128           // 10000000 128
-const byte port2bin[8] = {PORT1ON, PORT2ON, PORT3ON, PORT4ON, PORT5ON, PORT6ON, PORT7ON, PORT8ON};
+
+// current sensor types
+#define BTS7008             0             // Is output of a BTS7008-2EPA read through ROUTIS
+#define CC6900_10A          1             // CC6900-10A hall sensor on the Always-On ports
+#define CC6900_30A          2             // CC6900-30A hall sensor on the input
+
+//-----------------------------------------------------------------------
+// Board description
+//-----------------------------------------------------------------------
+// One entry per physical port, in port order. Everything the firmware needs to know about
+// the hardware is derived from this table at compile time: the port counts and the port part
+// of the board signature, the port dispatch, the current sense scan order and the status layout.
+// A variant board only needs to edit this table.
+// The table lives in flash, the compile time helpers read it directly and the firmware reads it
+// at run time through the port*() accessors below.
+//    kind:   board signature letter of the port (s, m, p or a)
+//    pin:    output pin, on the MCP23017 for 'm' ports and on the Arduino for 's' and 'p' ports
+//    chip:   74HC4051 address of the chip measuring the port
+//    dsel:   DSEL level selecting the port on that chip
+//    sensor: current sensor type
+struct port_t {
+  char  kind;
+  byte  pin;
+  byte  chip;
+  byte  dsel;
+  byte  sensor;
+};
+
+constexpr port_t boardPorts[] PROGMEM = {
+  // kind pin        chip dsel  sensor
+  { 'm',  PORT1EN,   0,   HIGH, BTS7008    },
+  { 'm',  PORT2EN,   0,   LOW,  BTS7008    },
+  { 'm',  PORT3EN,   1,   HIGH, BTS7008    },
+  { 'm',  PORT4EN,   1,   LOW,  BTS7008    },
+  { 'm',  PORT5EN,   2,   HIGH, BTS7008    },
+  { 'm',  PORT6EN,   2,   LOW,  BTS7008    },
+  { 'm',  PORT7EN,   3,   HIGH, BTS7008    },
+  { 'm',  PORT8EN,   3,   LOW,  BTS7008    },
+  { 'p',  PORT9EN,   4,   HIGH, BTS7008    },
+  { 'p',  PORT10EN,  4,   LOW,  BTS7008    },
+  { 'p',  PORT11EN,  5,   HIGH, BTS7008    },
+  { 'p',  PORT12EN,  5,   LOW,  BTS7008    },
+  { 'a',  NOPIN,     6,   HIGH, CC6900_10A },
+  { 'a',  NOPIN,     7,   HIGH, CC6900_10A },
+};
+
+constexpr byte PORTNUM = sizeof(boardPorts) / sizeof(port_t);
+
+constexpr byte countPorts(char kind, byte i = 0) {
+  return i >= PORTNUM ? 0 : (boardPorts[i].kind == kind) + countPorts(kind, i + 1);
+}
+
+constexpr byte firstPort(char kind, byte i = 0) {
+  return i >= PORTNUM ? PORTNUM : (boardPorts[i].kind == kind ? i : firstPort(kind, i + 1));
+}
+
+constexpr byte countRun(char kind, byte i) {
+  return i >= PORTNUM || boardPorts[i].kind != kind ? 0 : 1 + countRun(kind, i + 1);
+}
+
+constexpr bool switchablesFit(byte i = 0) {
+  return i >= PORTNUM ? true :
+         ((boardPorts[i].kind == 's' || boardPorts[i].kind == 'm') && i >= 8) ? false : switchablesFit(i + 1);
+}
+
+constexpr byte SWPORTS  = countPorts('s');
+constexpr byte MUXPORTS = countPorts('m');
+constexpr byte PWMPORTS = countPorts('p');
+constexpr byte AONPORTS = countPorts('a');
+constexpr byte FIRSTPWM = firstPort('p');
+
+static_assert(switchablesFit(), "switchable ports must be the first 8 ports, their status is an 8 bit bitmap");
+static_assert(PWMPORTS == 0 || countRun('p', FIRSTPWM) == PWMPORTS, "PWM ports must be contiguous");
+static_assert(SWPORTS + MUXPORTS + PWMPORTS + AONPORTS == PORTNUM, "unknown port kind in boardPorts");
+
+inline char portKind(byte port)   { return pgm_read_byte(&boardPorts[port].kind); }
+inline byte portPin(byte port)    { return pgm_read_byte(&boardPorts[port].pin); }
+inline byte portChip(byte port)   { return pgm_read_byte(&boardPorts[port].chip); }
+inline byte portDsel(byte port)   { return pgm_read_byte(&boardPorts[port].dsel); }
+inline byte portSensor(byte port) { return pgm_read_byte(&boardPorts[port].sensor); }
+
+//-----------------------------------------------------------------------
+// Current sense transfer functions
+//-----------------------------------------------------------------------
+// amps = raw * gain() + offset(), one specialization per sensor type
+// these are only evaluated at compile time to build the fixed point calibrations below
+template<byte sensor> struct Sense;
+
+template<> struct Sense<BTS7008> {
+  static constexpr float gain() { return (VCC / 1023.0) * KILIS / ROUTIS; }
+  static constexpr float offset() { return 0.0; }
+};
+
+template<> struct Sense<CC6900_10A> {
+  static constexpr float gain() { return (VCC / 1023.0) * 1000.0 / KOUTIS; }
+  static constexpr float offset() { return -(VCC / 2) * 1000.0 / KOUTIS; }
+};
+
+template<> struct Sense<CC6900_30A> {
+  static constexpr float gain() { return (VCC / 1023.0) * 1000.0 / KINIS; }
+  static constexpr float offset() { return -(VCC / 2) * 1000.0 / KINIS; }
+};
+
+// input voltage divider
+constexpr float DIVIDERGAIN = (VCC / 1023.0) * RDIVIN / RDIVOUT;
+
+//-----------------------------------------------------------------------
+// Fixed point calibration
+//-----------------------------------------------------------------------
+// the sampling path has no FPU to work with so every ADC channel is converted with an
+// integer scale and offset: milli-units = ((raw * gain) >> CALSHIFT) + offset
+// raw is at most 1023 so gain must stay below 2^21 for the product to fit in a long
+#define CALSHIFT            10
+
+struct cal_t {
+  long  gain;                             // milli-units per ADC count, scaled by 2^CALSHIFT
+  long  offset;                           // milli-units, the input current sensor is centered on VCC/2 so this exceeds an int
+};
+
+// ADC channels with a calibration: one per port then the input current and voltage
+#define CALINAMPS           PORTNUM
+#define CALINVOLTS          (PORTNUM + 1)
+#define CALCHANNELS         (PORTNUM + 2)
+
+constexpr long fixRound(float x) {
+  return x < 0 ? (long)(x - 0.5) : (long)(x + 0.5);
+}
+
+template<byte sensor> constexpr cal_t senseCal() {
+  return { fixRound(Sense<sensor>::gain() * 1000.0 * (1L << CALSHIFT)), fixRound(Sense<sensor>::offset() * 1000.0) };
+}
+
+constexpr cal_t dividerCal() {
+  return { fixRound(DIVIDERGAIN * 1000.0 * (1L << CALSHIFT)), 0 };
+}
+
+inline long applyCal(const cal_t &cal, unsigned int raw) {
+  return (((long)raw * cal.gain) >> CALSHIFT) + cal.offset;
+}
+
+//-----------------------------------------------------------------------
+// Fast protection
+//-----------------------------------------------------------------------
+// the ADC runs under interrupt and cycles through these channels, the interrupt keeps the latest
+// raw reading of each and compares it to the channel trip level, so a fault is caught within one
+// pass (3 conversions, about 330us) instead of at the next REFRESH
+#define ADCVIN              0             // input voltage on VSIN
+#define ADCIIN              1             // input current on ISIN
+#define ADCIOUT             2             // current of the port selected on ISOUT
+#define ADCCHANNELS         3
+#define NOTRIP              1024          // trip level above any ADC reading
+#define ALLPORTS            255           // port of a fault on the input, every port is cut
+#define ADCPRESCALE         (bit(ADPS2) | bit(ADPS1) | bit(ADPS0))   // ADC clock / 128, full 10 bit accuracy
+
+// scope capture: the interrupt also records the channels of each pass for one port, the current sense
+// stays on that port from the start of the capture to its end. The samples are kept to 8 bits so the ADC clock
+// can go up to /16 while capturing, that is about 40us per pass instead of 330us
+// while the sense is held the other ports are only covered by the input voltage and current fast trips,
+// so a capture gives up on its trigger after SCOPETIMEOUT and a triggered one lasts at most
+// SCOPESIZE * SCOPEMAXDECIMATE passes
+#define SCOPEPRESCALE       bit(ADPS2)    // ADC clock / 16
+#define SCOPETIMEOUT        10000         // ms a capture waits for its trigger
+#define SCOPEMAXDECIMATE    255           // a capture of SCOPESIZE single channel frames lasts up to about 2s
+
+// reverse of applyCal: the raw ADC reading at which a channel reaches milli, NOTRIP if it never does
+inline unsigned int calRaw(const cal_t &cal, long milli) {
+  long raw;
+
+  if ( cal.gain <= 0 )
+    return NOTRIP;
+  raw = ((milli - cal.offset) << CALSHIFT) / cal.gain;
+  if ( raw < 0 )
+    return 0;
+  return raw > 1023 ? NOTRIP : raw;
+}
+
+// fault causes
+#define FAULTOVERVOLT       1             // input voltage above MAXINVOLTS
+#define FAULTINAMPS         2             // input current above MAXINAMPS
+#define FAULTPORTAMPS       3             // port current above its fuse trip current
+#define FAULTPORTI2T        4             // port I2t above its fuse budget
+#define FAULTSHED           5             // port shed to keep the input current within the budget
+#define FAULTLOWVOLT        6             // port shed by the low voltage disconnect
+
+struct fault_t {
+  unsigned long time;                     // millis() when the fault was logged
+  unsigned long latency;                  // microseconds from detection to every faulty port being off
+  long          value;                    // reading that tripped, mV or mA
+  byte          cause;
+  byte          port;                     // ALLPORTS for input faults
+};
+
+// electronic fuse of a port: an instantaneous trip checked by the ADC interrupt and a time delayed
+// I2t trip checked every time the port current is scanned
+struct fuse_t {
+  unsigned int  trip;                     // mA, the port is cut as soon as it draws this
+  unsigned int  rated;                    // mA, the port can draw this forever
+  unsigned int  i2t;                      // A2s accumulated above the rated current before the port is cut
+};
+
+// power-on sequence of a port: ports being turned on are brought up one at a time, highest priority first
+struct sequence_t {
+  byte          priority;                 // 0 is the least important port
+  unsigned int  wait;                     // ms to wait after this port is turned on before the next one
+};
+
+// telemetry history: each record holds these fields, in this order, as 16 bit values
+//    seconds since the previous record, input current in 10mA, input voltage in 10mV,
+//    temperature, humidity and dewpoint in tenths, then the current of each port in 100mA
+//    and the level of each PWM port
+// the port fields only move every HISTORYPORTS records, sampling them at every record would fill the ring in minutes
+// a record is a varint bitmap, bit 0 set when the record samples the ports and bit f+1 when field f
+// changed since the previous record, followed by the change of each of them as a zigzag varint,
+// so a steady reading costs a byte
+constexpr byte HISTSLOWFIELDS = 6;
+constexpr byte HISTFIELDS = HISTSLOWFIELDS + PORTNUM + PWMPORTS;
+static_assert(HISTFIELDS < 32, "the history record bitmap is 32 bits");
+
+// loop timing of an FSM state, a command or a probe read
+// micros() moves in 4us steps at 16MHz so min and max are kept in those steps, which fits an int up to 262ms
+#define TIMESTEP            4             // us per step of min and max
+struct timing_t {
+  unsigned int  count;                    // count and total are halved together before either overflows, the mean stays right
+  unsigned int  min;                      // steps
+  unsigned int  max;                      // steps
+  unsigned long total;                    // us
+};
+
+//-----------------------------------------------------------------------
+// MCP23017 I/O expander
+//-----------------------------------------------------------------------
+// only instantiated when the board has multiplexed ports, on other boards
+// every call compiles to nothing and the library code is not linked in
+template<bool present> struct Expander {
+  void begin() {}
+  void pinMode(byte, byte) {}
+  void digitalWrite(byte, byte) {}
+  uint16_t readGPIO() { return 0; }
+};
+
+template<> struct Expander<true> : Adafruit_MCP23X17 {
+  void begin() { begin_I2C(); }
+};
+
 
 // temperature / Humidity Probe Ids
 #define SHT31_0x44          1
@@ -158,4 +352,108 @@ const byte port2bin[8] = {PORT1ON, PORT2ON, PORT3ON, PORT4ON, PORT5ON, PORT6ON,
 #define EEPROMNAMEBASE      0             // Base address of the port name config struct in EEPROM
 #define EEPROMCONFBASE      224           // base address of the config struct in EEPROM
 
+//-----------------------------------------------------------------------
+// EEPROM structures
+//-----------------------------------------------------------------------
+//      0       7  15
+//      -------------
+//    0|PORTNAME 1   |
+//   16|PORTNAME 2   |
+//    ....
+//  208|PORTNAME 14  |
+//  224|-------------|
+//  ...| config      |
+//  ...| space       |
+//  ...|-------------| EEPROMSETBASE
+//  ...| settings    |
+// 1023|             |
+//     ---------------
+
+// there are 2 types of config values we want to store in EEPROM
+// the first struct is rarely modified so it will live in the first 224 bytes of the EEPROM
+// we believe that these will be seldom modified so we can live with the 100k writes 
+// limitation of the EEPROM
+// Configuration struct to store long lived configs in EEPROM
+// The calibration and other long lived settings are in the settings struct at the end of the
+// EEPROM, EEPROM.put() only writes the bytes that changed so we do not wear level it either.
+
+// The second struct will be modified at each change of a port status so might happen a couple
+// times per session. This struct will use the remaining EEPROM space and be written at a
+// differnet address of that space at each write. validdata will be chosen so that it has a
+// low probability of collisions with other values in the struct.
+// Configuration struct to store regularly changed configs in EEPROM
+// Struct is 24 bytes long
+// the array sizes are derived from the board description so the struct follows the board
+// a config of another version is not read, the defaults are used instead
+#define CONFIGVERSION       2             // bumped when the layout changes, 1 was the layout without this byte
+struct config_t {
+  byte  currentData;                      // if this is CURRENTCONFIGFLAG then data is valid
+  byte  version;                          // CONFIGVERSION of the layout
+  byte  portStatus;                       // bitmap of all port statuses (0: Off, 1: On)
+  byte  pwmPorts[PWMPORTS];               // pwm value of ports 9-12 (0: Off, 255: On or 1: On if port in 's' mode)
+  byte  pwmPortMode[PWMPORTS];            // operation mode of the PWM ports (enum PWMModes)
+  byte  pwmPortPreset[PWMPORTS];          // last max value of the port, allows to store a preset
+  byte  pwmPortTempOffset[PWMPORTS];      // adjustable temperature offset for the PWM port in mode 3
+  byte  pwmClock[PWMTIMERS];              // clock select of the adjustable PWM timers, 0 leaves them to the PWM engine
+  byte  pwmBits;                          // resolution of Timer1 in bits when its clock is set, 8 to 16
+  unsigned int pwmFine;                   // level of the Timer1 port at the Timer1 resolution
+};
+
+// electrical values are kept in milli-units and only formatted at the protocol edge
+struct status_t {
+    int   portAmps[PORTNUM];              // this holds the current for each port in mA
+    long  inputAmps;                      // mA, the sensor range is +-30A
+    int   inputVolts;                     // mV
+    float temp;
+    float humid;
+    float dewpoint;
+    float pressure;
+    float tempProbe[MAXPROBES];           // tempearture reading in C.
+    float dewpointProbe[MAXPROBES];       // dewpoint at the probe in C, from its own humidity reading
+    byte  tempProbePort[MAXPROBES];       // i2c muc port on which the probe is found, 255 is used for non mux.
+    byte  tempProbeType[MAXPROBES];       // type of probe found, discovery stops at MAXPROBES
+};
+
+// dew heater control of a PWM port, each port runs at its own period independently of the probe readings
+struct dew_t {
+  unsigned int  period;                   // seconds between two control steps
+  float         kp;                       // PID gains in temperature feedback mode, the output is the PWM level
+  float         ki;
+  float         kd;
+};
+
+// scalar settings, read and written by id with the U and V commands
+#define PARAMBUDGET         0             // input current budget in mA, 0 disables load shedding
+#define PARAMHEADROOM       1             // mA below the budget the input must drop to before a shed port is restored
+#define PARAMLVDCUT         2             // input mV under which ports are shed, 0 disables the low voltage disconnect
+#define PARAMLVDRESTORE     3             // input mV the input must rise above before shed ports are restored
+#define PARAMCAPACITY       4             // battery capacity in mAh, 0 disables the state of charge estimate
+#define PARAMVEMPTY         5             // battery rest voltage in mV when empty
+#define PARAMVFULL          6             // battery rest voltage in mV when full
+#define PARAMRESIST         7             // battery and wiring internal resistance in milliohm
+#define PARAMPWMPHASE       8             // 1 staggers the phases of the PWM ports, 0 aligns them
+#define PARAMHISTORY        9             // seconds between two telemetry history records, 0 disables the history
+#define PARAMS              10
+#define MAXCAPACITY         1000000L      // largest battery capacity in mAh, the charge is counted in CHARGEUNIT
+#define MAXRESIST           10000L        // largest internal resistance in milliohm, keeps the sag of a 30A input current within a long
+#define CHARGEUNIT          36000L        // mA.ms in a unit of the battery charge, a hundredth of a mAh
+
+// long lived settings, members are only ever appended: a stored copy of the same version but shorter
+// is read over the defaults, so the members appended since it was written keep their defaults
+#define SETTINGSVERSION     1             // bumped when an existing member changes, appending one does not
+#define EEPROMSETSIZE       400           // bytes kept at the end of the EEPROM for the settings, leaves room to append
+struct settings_t {
+  byte  validData;                        // SETTINGSFLAG if the settings are valid
+  int   length;                           // sizeof(settings_t) when written
+  byte  version;                          // SETTINGSVERSION when written
+  cal_t cal[CALCHANNELS];                 // fixed point calibration of each ADC channel
+  fuse_t fuse[PORTNUM];                   // electronic fuse of each port
+  sequence_t sequence[PORTNUM];           // power-on sequence of each port
+  dew_t dew[PWMPORTS];                    // dew heater control of each PWM port
+  long  param[PARAMS];                    // scalar settings, last so that new ones are appended
+};
+static_assert(sizeof(settings_t) <= EEPROMSETSIZE, "the settings do not fit the EEPROM space kept for them");
+
+#define EEPROMSETBASE       (E2END + 1 - EEPROMSETSIZE)  // base address of the settings struct, the config space ends here
+
 #endif
@@ -0,0 +1,55 @@
+/*-----------------------------------------------------------------------
+ * BigPowerBox fixed point dewpoint
+ * License: GPLv3
+-----------------------------------------------------------------------*/
+#ifndef dewpoint_h
+#define dewpoint_h
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+
+// Magnus formula, b = 17.62 and c = 243.12C over water (-45C to 60C):
+//   gamma = ln(RH / 100) + b T / (c + T)
+//   Td    = c gamma / (b - gamma)
+// gamma is kept in Q12 fixed point and temperatures in hundredths of C, the whole
+// computation is two long divisions and a table lookup instead of the float log()
+#define MAGNUSQ           12              // fractional bits of gamma
+#define MAGNUSB           72172L          // b in Q12
+#define MAGNUSC           24312L          // c in hundredths of C
+
+// ln(n / 100) in Q12 for n = 1 to 100 % relative humidity
+const int lnHumid[100] PROGMEM = {
+  -18863, -16024, -14363, -13185, -12271, -11524, -10892, -10345,  -9863,  -9431,
+   -9041,  -8685,  -8357,  -8053,  -7771,  -7506,  -7258,  -7024,  -6802,  -6592,
+   -6392,  -6202,  -6020,  -5845,  -5678,  -5518,  -5363,  -5214,  -5070,  -4931,
+   -4797,  -4667,  -4541,  -4419,  -4300,  -4185,  -4072,  -3963,  -3857,  -3753,
+   -3652,  -3553,  -3457,  -3363,  -3271,  -3181,  -3093,  -3006,  -2922,  -2839,
+   -2758,  -2678,  -2600,  -2524,  -2449,  -2375,  -2302,  -2231,  -2161,  -2092,
+   -2025,  -1958,  -1892,  -1828,  -1764,  -1702,  -1640,  -1580,  -1520,  -1461,
+   -1403,  -1346,  -1289,  -1233,  -1178,  -1124,  -1071,  -1018,   -966,   -914,
+    -863,   -813,   -763,   -714,   -666,   -618,   -570,   -524,   -477,   -432,
+    -386,   -342,   -297,   -253,   -210,   -167,   -125,    -83,    -41,      0,
+};
+
+// dewpoint in hundredths of C from the temperature in hundredths of C and the relative
+// humidity in tenths of %, the humidity is clamped to 1-100% and interpolated between table entries
+int magnusDewpoint(int temp, int humid) {
+  humid = constrain(humid, 10, 1000);
+  int index = humid / 10 - 1;
+  long gamma = (int16_t)pgm_read_word(&lnHumid[index]);
+
+  if ( index < 99 )
+    gamma += ((int16_t)pgm_read_word(&lnHumid[index + 1]) - gamma) * (humid % 10) / 10;
+  gamma += MAGNUSB * temp / (MAGNUSC + temp);
+  return MAGNUSC * gamma / (MAGNUSB - gamma);
+}
+
+// float front end for the probe readings in C and %, a failed reading (NAN) gives NAN
+// the temperature is clamped to the range of the formula before the int conversion, which can not hold NAN or overflow
+float magnusDewpoint(float temp, float humid) {
+  if ( isnan(temp) || isnan(humid) )
+    return NAN;
+  return magnusDewpoint(int(constrain(temp, -45.0, 60.0) * 100), int(constrain(humid, 0.0, 100.0) * 10)) / 100.0;
+}
+
+#endif
@@ -0,0 +1,13 @@
+/*-----------------------------------------------------------------------
+ * BigPowerBox host build shim, just what dewpoint.h needs
+ * License: GPLv3
+-----------------------------------------------------------------------*/
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <math.h>
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#endif
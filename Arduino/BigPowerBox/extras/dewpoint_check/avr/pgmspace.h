@@ -0,0 +1,11 @@
+/*-----------------------------------------------------------------------
+ * BigPowerBox host build shim, the flash tables are plain arrays
+ * License: GPLv3
+-----------------------------------------------------------------------*/
+#ifndef pgmspace_h
+#define pgmspace_h
+
+#define PROGMEM
+#define pgm_read_word(addr) (*(addr))
+
+#endif
@@ -0,0 +1,58 @@
+/*-----------------------------------------------------------------------
+ * BigPowerBox fixed point dewpoint check, runs on the host
+ * License: GPLv3
+ *
+ * compares magnusDewpoint() of dewpoint.h with the floating point Magnus formula
+ * over the range the formula is given for, -45C to 60C and 1% to 100% humidity
+ *   g++ -I extras/dewpoint_check -o dewpoint_check extras/dewpoint_check/dewpoint_check.cpp && ./dewpoint_check
+ * from the sketch folder, the exit status is not 0 when a limit is exceeded
+-----------------------------------------------------------------------*/
+#include <stdio.h>
+#include "../../dewpoint.h"
+
+#define MAXERROR          0.1             // C, the accuracy given in the README above MINHUMID
+#define MINHUMID          5.0             // %, below it the table interpolation is coarser
+#define MAXERRORDRY       1.0             // C, over the whole humidity range
+
+// reference Magnus formula with the constants of dewpoint.h
+static double referenceDewpoint(double temp, double humid) {
+  double gamma = log(humid / 100.0) + 17.62 * temp / (243.12 + temp);
+  return 243.12 * gamma / (17.62 - gamma);
+}
+
+int main() {
+  double worst = 0, worstDry = 0;
+  double worstTemp = 0, worstHumid = 0;
+  int failed = 0;
+
+  // the probes report whole hundredths of C and tenths of %
+  for ( int t = -4500; t <= 6000; t += 5 ) {
+    for ( int h = 10; h <= 1000; h++ ) {
+      double error = fabs(magnusDewpoint(t, h) / 100.0 - referenceDewpoint(t / 100.0, h / 10.0));
+      if ( error > worstDry )
+        worstDry = error;
+      if ( h >= MINHUMID * 10 && error > worst ) {
+        worst = error;
+        worstTemp = t / 100.0;
+        worstHumid = h / 10.0;
+      }
+    }
+  }
+  printf("worst error %.3fC at %.2fC %.1f%%, %.3fC over 1-100%%\n", worst, worstTemp, worstHumid, worstDry);
+  if ( worst > MAXERROR || worstDry > MAXERRORDRY ) {
+    printf("FAIL: over %.1fC above %.0f%% or %.1fC below it\n", MAXERROR, MINHUMID, MAXERRORDRY);
+    failed++;
+  }
+
+  // a failed probe reading is NAN, it has to stay NAN and not turn into a number through the int conversion
+  if ( !isnan(magnusDewpoint(NAN, 50.0f)) || !isnan(magnusDewpoint(20.0f, NAN)) ) {
+    printf("FAIL: a NAN reading does not give a NAN dewpoint\n");
+    failed++;
+  }
+  // a reading out of the range of the formula is clamped to it
+  if ( isnan(magnusDewpoint(1000.0f, 50.0f)) || magnusDewpoint(-300.0f, 50.0f) < -100 ) {
+    printf("FAIL: a reading out of range is not clamped\n");
+    failed++;
+  }
+  return failed;
+}
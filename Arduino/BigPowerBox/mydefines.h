@@ -12,23 +12,64 @@
 //-----------------------------------------------------------------------
 // Constant Definitions
 //-----------------------------------------------------------------------
-#define MAXINVOLTS          14.7          // maximum allowed volts In, shutdown all output ports if exceeded
+#define MAXINVOLTS          14700         // maximum allowed millivolts In, shutdown all output ports if exceeded
+#define MAXINAMPS           20000         // maximum allowed milliamps In, shutdown all output ports if exceeded
+#define MAXPORTAMPS         8000          // default fuse trip current of a port in mA, shutdown the port if exceeded
+#define FUSERATED           5000          // default fuse rated current of a port in mA
+#define FUSEI2T             30            // default fuse I2t budget of a port in A2s, about 2.5s at 6A
+#define FUSEMAXSTEP         5000          // longest time between two scans of a port integrated in its I2t, in ms
+#define SEQWAIT             250           // default wait after a port is turned on before the next one, in ms
+#define SEQMAXAMPS          10000         // the sequencer holds the next port while the input draws more mA than this
+#define SEQTIMEOUT          2000          // longest it holds it, in ms, so a steady load cannot block the sequence
+#define SHEDBUDGET          0             // default input current budget in mA, 0 disables load shedding
+#define SHEDHEADROOM        1000          // default headroom in mA below the budget before shed ports are restored
+#define SHEDFILTER          8             // the filtered input current moves 1/SHEDFILTER of the way to each reading
+#define SHEDINTERVAL        2000          // ms between two shedding or restore steps, lets the input current settle
+#define SHEDSTEPS           4             // dew heaters are throttled in SHEDSTEPS steps before ports are switched off
+#define LVDCUT              0             // default low voltage disconnect in mV, 0 disables it
+#define LVDRESTORE          12200         // default voltage in mV above which ports shed by the disconnect are restored
+#define BATTCAPACITY        0             // default battery capacity in mAh, 0 disables the state of charge estimate
+#define BATTVEMPTY          11800         // default rest voltage of an empty battery in mV, 12V lead acid
+#define BATTVFULL           12700         // default rest voltage of a full battery in mV
+#define BATTRESIST          50            // default internal resistance in milliohm
+#define SOCBLEND            16384         // the charge moves 1/SOCBLEND of the way to the rest voltage estimate at every read, about 55 minutes
+#define PWMPHASE            1             // default PWM phase staggering, 0 keeps the Arduino timer setup
+#define PWMBITS             16            // default Timer1 resolution once its clock is set
+#define RIPPLESAMPLES       2048          // input current samples in a ripple measurement window, at most 2048 for the sums to fit
+#define HISTORYITVL         60            // default seconds between two telemetry history records, 0 disables the history
+#define HISTORYSIZE         128           // bytes of SRAM for the telemetry history ring
+#define HISTORYPORTS        15            // every 15th history record also samples the port currents and PWM levels
+#define SCOPESIZE           192           // bytes of SRAM for the scope capture, one 8 bit sample each
+#define FAULTLOGSIZE        4             // number of faults kept for the Y command, a power of 2
+#define SENSESETTLE         16            // ADC passes ignored on the port current sense after it is moved to another port
 #define REFRESH             200           // read port values every REFRESH milliseconds
-#define TEMPITVL            1             // adjust dew heaters every TEMPITVL minutes
+#define SENSORITVL          5             // read the temperature probes every SENSORITVL seconds
+#define DEWPERIOD           5             // default dew heater control period of a PWM port in seconds
 #define SERIALPORTSPEED     9600          // 9600, 14400, 19200, 28800, 38400, 57600
-#define QUEUELENGTH         5             // number of commands that can be saved in the serial queue
-#define MAXCOMMAND          21            // max length of a command
+#define BAUDVERIFY          2000          // ms after a b command switch for the host to ping, else back to SERIALPORTSPEED
+#define QUEUELENGTH         8             // number of commands that can be saved in the serial queue
+#define QUEUESIZE           80            // bytes of the queue, holds QUEUELENGTH short commands or 3 of MAXCOMMAND
+#define MAXCOMMAND          25            // max length of a command
+#define REPLYSIZE           64            // size of the reply buffer, the longest formatted reply is the D banner
 #define NAMELENGTH          16            // max lenght of a port name
+#define MAXPROBES           8             // max number of temperature probes, one per mux port
 #define EOFSTR              '\n'
 #define EOCOMMAND           '#'           // defines the end character of a command
 #define SOCOMMAND           '>'           // defines the start character of a command
 #define CURRENTCONFIGFLAG   99            // the config struct has a currentdata field indicating whether it is in use
 #define OLDCONFIGFLAG       0             // currentdata set this when eeprom structure is no longer in use
+#define SETTINGSFLAG        77            // the settings struct has a validData field indicating it was written by us
+#define CALSAMPLES          16            // number of ADC readings averaged when calibrating a channel
+#define CALSETTLE           5             // milliseconds to let the current sense settle after selecting a port
 #define PWMMIN              0
 #define PWMMAX              255
-#define KP                  7.0F
-#define KI                  0.3F
-#define KD                  0.0F
+#define KP                  7.0F          // default PID gains of a PWM port in temperature feedback mode
+#define KI                  0.3F          // per second
+#define KD                  0.0F          // seconds
+#define TUNERISE            3.0F          // auto-tune relay setpoint in C above the probe temperature at start
+#define TUNEHYST            0.2F          // auto-tune relay hysteresis in C on each side of the setpoint
+#define TUNECYCLES          3             // oscillation cycles averaged by the auto-tune, after the first one
+#define TUNETIMEOUT         60            // auto-tune gives up after TUNETIMEOUT minutes
 // port states bitmap
 #define ALLOFF              0             // 00000000 ALL OFF
 #define ALLON               255           // 11111111 ALL ON
@@ -43,5 +84,10 @@
 #define DPRINT(...)
 #define DPRINTLN(...)
 #endif
+// print the cost of one sample conversion at boot, float reference vs fixed point
+//#define BENCHMARK 1
+// time each probe and each command letter on its own in the t reply, about 430 bytes of RAM
+// that only fit a bench build with a smaller history and fewer probes
+//#define TIMINGDETAIL 1
 
 #endif
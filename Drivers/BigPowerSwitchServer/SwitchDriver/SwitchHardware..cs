@@ -62,8 +62,14 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
         private const string EOC = "#";                 // End of Command marker
         private const string PINGCOMMAND = ">P#";       // ping command
         private const string PINGREPLY = ">POK#";       // ping reply
+        private const int NEGOTIATEDBAUD = 115200;      // rate asked to the device once connected at 9600
+        private const int BAUDVERIFY = 2000;            // ms the device waits for a ping at the new rate before it falls back to 9600
+        private const int BOOTBACKOFF = 100;            // ms before the first ping while waiting for the device to boot, doubled at each ping
+        private const int BOOTBACKOFFMAX = 1600;
+        private const int BOOTTIMEOUT = 15000;          // ms to wait for the device to boot
         private const string GETSTATUS = ">S#";         // status request command
         private const string GETDESCRIPTION = ">D#";    // board description request command
+        private const string GETDUMP = ">d#";           // configuration dump request command
         private static string BoardSignature;           // string to store the board geometry
         private static string deviceName;               // the device name stored on the board
         private static string hwRevision;               // the HW revision sotred on the board
@@ -235,8 +241,8 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
         {
             get
             {
-                LogMessage("SH.SupportedActions Get", "Returning empty ArrayList");
-                return new ArrayList();
+                LogMessage("SH.SupportedActions Get", "Returning calibration actions");
+                return new ArrayList() { "Calibrate", "GetCalibration" };
             }
         }
 
@@ -249,6 +255,31 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
         /// </returns>
         public static string Action(string actionName, string actionParameters)
         {
+            // Calibration channels are numbered 0..ports-1 for the outputs, then input current and input voltage
+            if (actionName.Equals("GetCalibration", StringComparison.OrdinalIgnoreCase))
+            {
+                // parameters: "channel", returns "gain:offset" (gain scaled by 1024, offset in mA/mV)
+                int channel = int.Parse(actionParameters, CultureInfo.InvariantCulture);
+                string response = CommandString(string.Format(">L:{0, 0:D2}#", channel), false);
+                LogMessage("SH.Action", $"GetCalibration {channel} returned {response}");
+                if (!response.StartsWith(">L:"))
+                    throw new InvalidValueException("GetCalibration", actionParameters, "a calibration channel");
+                return response.Substring(response.IndexOf(':', 2) + 1);
+            }
+            if (actionName.Equals("Calibrate", StringComparison.OrdinalIgnoreCase))
+            {
+                // parameters: "channel:milli", milli is the reference reading in mA/mV, 0 sets the zero point
+                string[] args = actionParameters.Split(':');
+                if (args.Length != 2)
+                    throw new InvalidValueException("Calibrate", actionParameters, "channel:milli");
+                int channel = int.Parse(args[0], CultureInfo.InvariantCulture);
+                long milli = long.Parse(args[1], CultureInfo.InvariantCulture);
+                LogMessage("SH.Action", $"Calibrate channel {channel} with {milli}");
+                string response = CommandString(string.Format(">K:{0, 0:D2}:{1}#", channel, milli), false);
+                if (response.StartsWith(">KERR"))
+                    throw new InvalidValueException("Calibrate", actionParameters, "a calibration channel");
+                return response;
+            }
             LogMessage("SH.Action", $"Action {actionName}, parameters {actionParameters} is not implemented");
             throw new ActionNotImplementedException("Action " + actionName + " is not implemented by this driver");
         }
@@ -417,6 +448,7 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
                                 throw new InvalidValueException("Invalid COM port", comPort.ToString(), String.Join(", ", System.IO.Ports.SerialPort.GetPortNames()));
                             }
 
+                            Stopwatch connectWatch = Stopwatch.StartNew();
                             objSerial = new Serial
                             {
                                 Speed = SerialSpeed.ps9600,
@@ -424,33 +456,39 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
                                 Connected = true
                             };
 
-                            // Wait a second for the serial connection to establish
-                            System.Threading.Thread.Sleep(1000);
-
-                            objSerial.ClearBuffers();
-
-                            // Poll the device (with a short timeout value) until successful,
-                            // or until we've reached the retry count limit of 3...
-                            objSerial.ReceiveTimeout = 1;
+                            // Opening the port resets the board: wait for the >D:...# banner it sends once setup() is done,
+                            // or for the reply to a ping sent with an exponential backoff when nothing comes in
+                            int backoff = BOOTBACKOFF;
                             bool success = false;
-                            for (int retries = 3; retries >= 0; retries--)
+                            objSerial.ReceiveTimeoutMs = backoff;
+                            while (connectWatch.ElapsedMilliseconds < BOOTTIMEOUT)
                             {
                                 string response = "";
                                 try
                                 {
-                                    objSerial.Transmit(PINGCOMMAND);
                                     response = objSerial.ReceiveTerminated(EOC).Trim();
                                 }
                                 catch (Exception)
                                 {
-                                    // ignore any errors here
+                                    // nothing yet
                                 }
-                                if (response == PINGREPLY)
+                                if (response == PINGREPLY || response.StartsWith(">D:"))
                                 {
                                     success = true;
+                                    LogMessage("SH.Connected", "Device ready after {0} ms ({1})", connectWatch.ElapsedMilliseconds, response);
+                                    // drop the reply to a ping still in flight
+                                    System.Threading.Thread.Sleep(50);
+                                    objSerial.ClearBuffers();
                                     break;
                                 }
+                                if (response == "")
+                                {
+                                    objSerial.Transmit(PINGCOMMAND);
+                                    backoff = Math.Min(backoff * 2, BOOTBACKOFFMAX);
+                                    objSerial.ReceiveTimeoutMs = backoff;
+                                }
                             }
+                            objSerial.ReceiveTimeout = 1;
 
                             if (!success)
                             {
@@ -464,6 +502,9 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
                             connectedState = true;
                             LogMessage("SH.Connected Set", "Connected to port {0}", comPort);
 
+                            // move the link to a faster rate if the firmware supports it, still with the short timeout
+                            NegotiateBaud();
+
                             // Restore default timeout value...
                             objSerial.ReceiveTimeout = 10;
 
@@ -473,17 +514,22 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
                             // lets populate the Status struct
                             tl.LogMessage("SH.Connected", "Query device status");
                             QueryDeviceStatus();
-                            // populate the port names
-                            tl.LogMessage("SH.Connected", "Query Port Names");
-                            QueryPortNames();
-                            // Query the PWM ports for their options (mode, value, temp offset) also modify the port type if the PWM port is switchable
-                            if (havePWM)
+                            // populate the port names and the PWM port options in one round trip, one per option on older firmware
+                            tl.LogMessage("SH.Connected", "Query configuration dump");
+                            if (!QueryConfigDump())
                             {
-                                tl.LogMessage("SH.Connected", "Query PWM Ports");
-                                QueryPWMPorts();
+                                // populate the port names
+                                tl.LogMessage("SH.Connected", "Query Port Names");
+                                QueryPortNames();
+                                // Query the PWM ports for their options (mode, value, temp offset) also modify the port type if the PWM port is switchable
+                                if (havePWM)
+                                {
+                                    tl.LogMessage("SH.Connected", "Query PWM Ports");
+                                    QueryPWMPorts();
+                                }
                             }
                             // we are now initialized
-                            tl.LogMessage("SH.Connected", "Initialization done");
+                            LogMessage("SH.Connected", "Initialization done, time to connected {0} ms", connectWatch.ElapsedMilliseconds);
 
                             // now that all datastructures have been populated lets allow the worker to run and poll the board
                             workerCanRun = true;
@@ -1020,6 +1066,64 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
 
         }
 
+        /// <summary>
+        /// Round trip of a ping in ms, -1 if the device does not answer
+        /// </summary>
+        private static double PingTime()
+        {
+            Stopwatch watch = Stopwatch.StartNew();
+            try
+            {
+                objSerial.Transmit(PINGCOMMAND);
+                if (objSerial.ReceiveTerminated(EOC).Trim() == PINGREPLY)
+                    return watch.Elapsed.TotalMilliseconds;
+            }
+            catch (Exception)
+            {
+                // no answer at this rate
+            }
+            return -1;
+        }
+
+        /// <summary>
+        /// Moves the link to NEGOTIATEDBAUD: the device acks at 9600, both sides switch and a ping at the
+        /// new rate confirms it. Without the ping the device falls back to 9600 after BAUDVERIFY ms, and so do we.
+        /// A firmware without the b command does not answer it and the link stays at 9600.
+        /// </summary>
+        private static void NegotiateBaud()
+        {
+            double slow = PingTime();
+            string response = "";
+
+            try
+            {
+                objSerial.Transmit(string.Format(">b:{0}#", NEGOTIATEDBAUD));
+                response = objSerial.ReceiveTerminated(EOC).Trim();
+            }
+            catch (Exception)
+            {
+                // older firmware
+            }
+            if (response != string.Format(">b:{0}#", NEGOTIATEDBAUD))
+            {
+                LogMessage("SH.NegotiateBaud", "Device stays at 9600 baud ({0}), ping {1:F1} ms", response, slow);
+                return;
+            }
+            objSerial.Speed = SerialSpeed.ps115200;
+            System.Threading.Thread.Sleep(10);
+            objSerial.ClearBuffers();
+            double fast = PingTime();
+            if (fast < 0)
+            {
+                LogMessage("SH.NegotiateBaud", "No ping at {0} baud, falling back to 9600", NEGOTIATEDBAUD);
+                objSerial.Speed = SerialSpeed.ps9600;
+                System.Threading.Thread.Sleep(BAUDVERIFY + 500);
+                objSerial.ClearBuffers();
+                return;
+            }
+            LogMessage("SH.NegotiateBaud", "Serial link at {0} baud, ping {1:F1} ms ({2:F1} ms at 9600)", NEGOTIATEDBAUD, fast, slow);
+        }
+
         /// <summary>
         /// Queries the device for a status string and updates the driver's internal datastructures
         /// </summary>
@@ -1515,6 +1619,86 @@ namespace ASCOM.ShortCircuitBigPowerSwitch.Switch
             }
         }
 
+        /// <summary>
+        /// queries the device for its whole configuration in one reply and populates the port names and PWM port options
+        /// 'd:signature:name of each port:mode:offset:preset of each PWM port:type:mux port of each probe'
+        /// returns false on firmware without the dump
+        /// </summary>
+        private static bool QueryConfigDump()
+        {
+            CheckConnected("QueryConfigDump");
+
+            string response;
+            // older firmware does not answer, do not wait the full timeout for it
+            objSerial.ReceiveTimeout = 1;
+            try
+            {
+                response = CommandString(GETDUMP, false);
+            }
+            catch (Exception)
+            {
+                tl.LogMessage("SH.QueryConfigDump", "no dump from the device");
+                return false;
+            }
+            finally
+            {
+                objSerial.ReceiveTimeout = 10;
+            }
+
+            // the counts follow the signature, one letter per port then one per probe
+            string[] words = response.Split(':');
+            int firstPWM = BoardSignature.IndexOf('p');
+            int nPWM = BoardSignature.Split('p').Length - 1;
+            int nProbes = BoardSignature.Length - portNum;
+            if (words[0] != "d" || words.Length != 2 + portNum + nPWM * 3 + nProbes * 2 || words[1] != BoardSignature)
+            {
+                tl.LogMessage("SH.QueryConfigDump", "dump does not match the signature: " + response);
+                return false;
+            }
+
+            for (short id = 0; id < numSwitch; id++)
+            {
+                if (deviceFeatures[id].type <= CURRENT)
+                {
+                    if (id >= portNum)
+                        deviceFeatures[id].name = words[2 + id - portNum] + " Current (A)";
+                    else
+                        deviceFeatures[id].name = words[2 + id];
+                }
+            }
+            for (int i = 0; i < numSwitch; i++)
+            {
+                if (deviceFeatures[i].type != MODE && deviceFeatures[i].type != SETTEMP)
+                    continue;
+                int settings = 2 + portNum + (deviceFeatures[i].port - 1 - firstPWM) * 3;
+                if (deviceFeatures[i].type == MODE)
+                {
+                    deviceFeatures[i].value = Convert.ToDouble(words[settings]);
+                    // if we get a mode 1 then the pwm switch is configured as an on/off switch
+                    if (deviceFeatures[i].value == 1)
+                    {
+                        deviceFeatures[deviceFeatures[i].port - 1].type = SWH;
+                        deviceFeatures[deviceFeatures[i].port - 1].maxvalue = 1;
+                    }
+                    deviceFeatures[i].name = deviceFeatures[deviceFeatures[i].port - 1].name + " Mode";
+                    tl.LogMessage("SH.QueryConfigDump", "switch " + i + " mode " + deviceFeatures[i].value + " preset " + words[settings + 2]);
+                }
+                else
+                {
+                    deviceFeatures[i].value = Convert.ToDouble(words[settings + 1]);
+                    deviceFeatures[i].name = deviceFeatures[deviceFeatures[i].port - 1].name + " Temperature Offset";
+                    tl.LogMessage("SH.QueryConfigDump", "switch " + i + " offset " + deviceFeatures[i].value);
+                }
+                deviceFeatures[i].state = true;
+            }
+            for (int i = 0; i < nProbes; i++)
+            {
+                int probe = 2 + portNum + nPWM * 3 + i * 2;
+                tl.LogMessage("SH.QueryConfigDump", "probe " + i + " type " + words[probe] + " mux port " + words[probe + 1]);
+            }
+            return true;
+        }
+
         /// <summary>
         /// Copies the port names from the setup dialog to the device
         /// </summary>
@@ -23,6 +23,7 @@
 #define DRIVER_VERSION 0x001
 #define DRIVER_NAME "indigo_aux_pbex"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -31,12 +32,17 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <fcntl.h>
 #include <sys/time.h>
+#include <sys/select.h>
 #include <sys/termios.h>
+#include <sys/mman.h>
 #include <indigo/indigo_driver_xml.h>
 #include <indigo/indigo_io.h>
 
 #include "indigo_aux_pbex.h"
+#include "indigo_aux_pbex_record.h"
+#include "indigo_aux_pbex_shm.h"
 
 //  some basic commands to interact with the switch
 char *SOC = ">";				 // Start of Command marker
@@ -45,10 +51,26 @@ char *PINGCOMMAND = ">P#";		 // ping command
 char *PINGREPLY = ">POK#";		 // ping reply
 char *GETSTATUS = ">S#";		 // status request command
 char *GETDESCRIPTION = ">D#";	 // board description request command
+char *GETDUMP = ">d#";			 // configuration dump request command
+char *GETEVENTS = ">E#";		 // extended status request command
+char *GETTUNE = ">Z#";			 // auto-tune status request command
+char *GETTIMING = ">t#";		 // loop timing request command
+char *CLEARTIMING = ">t:0#";	 // loop timing reset command
+char *GETHISTORY = ">h#";		 // telemetry history request command
+char *GETSCOPE = ">c#";			 // scope capture request command
 static char BoardSignature[128]; // string to store the board geometry
+static char deviceDescription[128]; // the whole description reply, the layout built from it is reused while it does not change
 static char deviceName[50];	 // the device name stored on the board
 static char hwRevision[10];	 // the HW revision sotred on the board
 static char portsonly[50];
+#define LAYOUT_CACHE ".indigo/aux_pbex.layout" // in $HOME, the description of the last device seen followed by its configuration dump
+#define HISTORY_LOG ".indigo/aux_pbex.history.csv" // in $HOME, the telemetry history recorded by the device
+#define HISTORY_FIELDS 6 // seconds since the previous record, input current, input voltage, temperature, humidity and dewpoint
+#define HISTORY_MAXFIELDS 31 // the slow fields then the current of each port and the level of each PWM port
+#define HISTORY_HEADER "time,Input current [A],Input voltage [V],Temperature [C],Humidity [%],Dewpoint [C]"
+#define RECORD_FILE ".indigo/aux_pbex.record" // in $HOME, every status read, see indigo_aux_pbex_record.h
+#define RECORD_MAX_SIZE (64L << 20) // size of the record file, about 9 months of records of 40 values at RECORD_INTERVAL
+#define RECORD_INTERVAL 60000 // each record sums up the status reads over this interval
 #define SWH 0				// switched port type
 #define MPX 1				// Multiplexed port type
 #define PWM 2				// PWM port type
@@ -63,6 +85,22 @@ static char portsonly[50];
 #define SETTEMP 11			// PWM port temperature offset switch
 #define PRESSURE 12			// Pressure (sensor)
 #define UPDATEINTERVAL 2000 // how often to update the status
+#define TIMINGINTERVAL 10000 // how often to read the loop timing of the device
+#define HISTORYINTERVAL 60000 // how often to download the telemetry history of the device, well within the span of its ring
+#define NEGOTIATED_BAUD 115200	// rate asked to the device once connected at 9600
+#define NEGOTIATED_SPEED B115200
+#define BAUD_VERIFY 2000		// ms the device waits for the ping at the new rate before it falls back to 9600
+#define BOOT_BACKOFF 100		// ms before the first ping while waiting for the device to boot, doubled at each ping
+#define BOOT_BACKOFF_MAX 1600
+#define BOOT_TIMEOUT 15000		// ms to wait for the device to boot
+#define PARAM_BUDGET 0		// input current budget scalar setting id
+#define PARAM_HEADROOM 1	// load shedding headroom scalar setting id
+#define PARAM_LVDCUT 2		// first battery scalar setting id, the battery property items follow the setting ids
+#define PARAM_PWMPHASE 8	// PWM phase staggering scalar setting id
+#define PARAM_HISTORY 9		// telemetry history interval scalar setting id
+#define TUNE_RUNNING 1		// auto-tune states reported by the Z command
+#define TUNE_DONE 2
+#define TUNE_FAILED 3
 
 #define PRIVATE_DATA ((pbex_private_data *)device->private_data)
 
@@ -109,9 +147,62 @@ static char portsonly[50];
 #define AUX_INFO_VOLTAGE_ITEM								(AUX_INFO_PROPERTY->items + 0)
 #define AUX_INFO_CURRENT_ITEM								(AUX_INFO_PROPERTY->items + 1)
 #define AUX_INFO_POWER_ITEM									(AUX_INFO_PROPERTY->items + 2)
+#define AUX_INFO_CHARGE_ITEM								(AUX_INFO_PROPERTY->items + 3)
 
 #define AUX_STATE_PROPERTY								(PRIVATE_DATA->state_property)
 
+#define AUX_CALIBRATION_PROPERTY					(PRIVATE_DATA->calibration_property)
+
+#define AUX_FUSE_PROPERTY							(PRIVATE_DATA->fuse_property)
+
+#define AUX_BUDGET_PROPERTY							(PRIVATE_DATA->budget_property)
+#define AUX_BUDGET_CURRENT_ITEM						(AUX_BUDGET_PROPERTY->items + 0)
+#define AUX_BUDGET_HEADROOM_ITEM					(AUX_BUDGET_PROPERTY->items + 1)
+
+#define AUX_BATTERY_PROPERTY						(PRIVATE_DATA->battery_property)
+
+#define AUX_PWM_TIMER_PROPERTY						(PRIVATE_DATA->pwm_timer_property)
+#define AUX_PWM_STAGGER_ITEM						(AUX_PWM_TIMER_PROPERTY->items + 0)
+#define AUX_PWM_TIMER2_CLOCK_ITEM					(AUX_PWM_TIMER_PROPERTY->items + 1)
+#define AUX_PWM_TIMER1_CLOCK_ITEM					(AUX_PWM_TIMER_PROPERTY->items + 2)
+#define AUX_PWM_TIMER1_BITS_ITEM					(AUX_PWM_TIMER_PROPERTY->items + 3)
+
+#define AUX_AUTOTUNE_PROPERTY						(PRIVATE_DATA->autotune_property)
+#define AUX_AUTOTUNE_PORT_ITEM						(AUX_AUTOTUNE_PROPERTY->items + 0)
+
+#define AUX_AUTOTUNE_STATUS_PROPERTY				(PRIVATE_DATA->autotune_status_property)
+#define AUX_AUTOTUNE_CYCLE_ITEM						(AUX_AUTOTUNE_STATUS_PROPERTY->items + 0)
+#define AUX_AUTOTUNE_PERIOD_ITEM					(AUX_AUTOTUNE_STATUS_PROPERTY->items + 1)
+#define AUX_AUTOTUNE_AMPLITUDE_ITEM					(AUX_AUTOTUNE_STATUS_PROPERTY->items + 2)
+#define AUX_AUTOTUNE_KP_ITEM						(AUX_AUTOTUNE_STATUS_PROPERTY->items + 3)
+#define AUX_AUTOTUNE_KI_ITEM						(AUX_AUTOTUNE_STATUS_PROPERTY->items + 4)
+#define AUX_AUTOTUNE_KD_ITEM						(AUX_AUTOTUNE_STATUS_PROPERTY->items + 5)
+
+#define AUX_TIMING_PROPERTY							(PRIVATE_DATA->timing_property)
+#define AUX_TIMING_GAP_ITEM							(AUX_TIMING_PROPERTY->items + 0)
+#define AUX_TIMING_IDLE_ITEM						(AUX_TIMING_PROPERTY->items + 1)
+#define AUX_TIMING_READ_ITEM						(AUX_TIMING_PROPERTY->items + 2)
+#define AUX_TIMING_DEW_ITEM							(AUX_TIMING_PROPERTY->items + 3)
+#define AUX_TIMING_SWAP_ITEM						(AUX_TIMING_PROPERTY->items + 4)
+#define AUX_TIMING_PROBES_ITEM						(AUX_TIMING_PROPERTY->items + 5)
+#define AUX_TIMING_COMMANDS_ITEM					(AUX_TIMING_PROPERTY->items + 6)
+
+#define AUX_HISTORY_PROPERTY						(PRIVATE_DATA->history_property)
+#define AUX_HISTORY_INTERVAL_ITEM					(AUX_HISTORY_PROPERTY->items + 0)
+
+#define AUX_SCOPE_PROPERTY							(PRIVATE_DATA->scope_property)
+#define AUX_SCOPE_PORT_ITEM							(AUX_SCOPE_PROPERTY->items + 0)
+#define AUX_SCOPE_INPUTS_ITEM						(AUX_SCOPE_PROPERTY->items + 1)
+#define AUX_SCOPE_TRIGGER_ITEM						(AUX_SCOPE_PROPERTY->items + 2)
+#define AUX_SCOPE_PRE_ITEM							(AUX_SCOPE_PROPERTY->items + 3)
+#define AUX_SCOPE_DECIMATE_ITEM						(AUX_SCOPE_PROPERTY->items + 4)
+
+#define AUX_SCOPE_BLOB_PROPERTY						(PRIVATE_DATA->scope_blob_property)
+#define AUX_SCOPE_BLOB_ITEM							(AUX_SCOPE_BLOB_PROPERTY->items + 0)
+
+#define AUX_TIMING_CLEAR_PROPERTY					(PRIVATE_DATA->timing_clear_property)
+#define AUX_TIMING_CLEAR_ITEM						(AUX_TIMING_CLEAR_PROPERTY->items + 0)
+
 #define AUX_ALWAYS_ON_PORTS_PROPERTY (PRIVATE_DATA->always_on_port_property)
 #define AUX_ALWAYS_ON_PORTITEM_1					(AUX_ALWAYS_ON_PORTS_PROPERTY->items + 0)
 #define AUX_ALWAYS_ON_PORTITEM_2					(AUX_ALWAYS_ON_PORTS_PROPERTY->items + 1)
@@ -135,6 +226,27 @@ typedef struct
 	indigo_property *weather_property;
 	indigo_property *info_property;
 	indigo_property *state_property;
+	indigo_property *calibration_property;
+	indigo_property *fuse_property;
+	indigo_property *budget_property;
+	indigo_property *battery_property;
+	indigo_property *pwm_timer_property;
+	indigo_property *autotune_property;
+	indigo_property *autotune_status_property;
+	indigo_property *timing_property;
+	indigo_property *timing_clear_property;
+	struct timeval timing_stamp;
+	indigo_property *history_property;
+	struct timeval history_stamp;
+	indigo_property *scope_property;
+	indigo_property *scope_blob_property;
+	pbex_record_header *record;		// mapped record file, NULL until the first status read
+	bool record_failed;				// the record file could not be mapped, not retried until the next connection
+	struct timeval record_stamp;	// time of the previous record
+	double record_sum[PBEX_RECORD_FIELDS];	// sum, last or peak of each value read since the previous record
+	uint32_t record_reads;
+	pbex_shm_segment *shm;			// latest status published to the processes on this host, NULL until the first status read
+	bool shm_failed;
 	int count;
 	int version;
 
@@ -160,9 +272,45 @@ Feature *deviceFeatures = NULL;
 int nTotalFeatures = 0;
 int portNum = 0;
 bool havePWM = false;
+unsigned int blownFuses = 0;	// bitmap of the ports cut by their electronic fuse
+unsigned int shedPorts = 0;		// bitmap of the ports switched off to keep the input current within the budget
+int lowVoltage = 0;				// the low voltage disconnect is holding ports off
+int batteryCharge = -1;			// battery state of charge in %, -1 when the device has no battery capacity set
+int tuneState = -1;				// last auto-tune state reported by the device
+bool haveTiming = false;		// the firmware reports its loop timing
+bool haveHistory = false;		// the firmware records a telemetry history
+double historyLast = -1;		// time of the newest record in the history log, -1 until read from the log
+bool haveScope = false;			// the firmware captures port current waveforms
+// Features of one type and the items showing them, built with the properties so that the periodic
+// updates and the handlers only visit the features behind a property instead of scanning them all
+#define SPAN_SIZE 32
+typedef struct
+{
+	int count;
+	int feature[SPAN_SIZE];			// index in deviceFeatures
+	indigo_item *item[SPAN_SIZE];	// item showing the feature
+} FeatureSpan;
+FeatureSpan mpxSpan;		// multiplexed ports in the switchable power outlets
+FeatureSpan pwmSpan;		// variable PWM ports in the PWM power outlets
+FeatureSpan switchSpan;		// on/off PWM ports in the PWM switches
+FeatureSpan aonSpan;		// always-on ports
+FeatureSpan currentSpan;	// output current sensors
+FeatureSpan modeSpan;		// PWM port modes
+FeatureSpan offsetSpan;		// PWM port temperature offsets
+FeatureSpan weatherSpan;	// temperature, humidity, dewpoint and pressure
+FeatureSpan inputSpan;		// input current and voltage
 static bool pbex_command(indigo_device *device, char *command, char *response, int max);
+static double pbex_elapsed_ms(struct timeval *start);
 // Utility routines 
 //
+void SpanAdd(FeatureSpan *span, int feature, indigo_item *item)
+{
+	if (span->count < SPAN_SIZE)
+	{
+		span->feature[span->count] = feature;
+		span->item[span->count++] = item;
+	}
+}
 void Validate(char* message, short id)
 {
 	if (id < 0 || id >= nTotalFeatures)
@@ -497,13 +645,36 @@ indigo_result CreateStateItems(indigo_device *device)
 	return INDIGO_OK;
 }
 
+/// Reads the extended status '>E:<fuses>:<peak>:<shed>:<throttle>:<low voltage>:<charge>#'
+void QueryPowerEvents(indigo_device *device)
+{
+	char response[100] = {0};
+
+	if (!pbex_command(device, GETEVENTS, response, sizeof(response)) ||
+		sscanf(response, ">E:%u:%*d:%u:%*d:%d:%d", &blownFuses, &shedPorts, &lowVoltage, &batteryCharge) != 4)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "QueryPowerEvents Invalid response from device: %s", response);
+	}
+}
+
 indigo_result UpdateStateItems(indigo_device *device)
 {
-	
+	// a port cut by its fuse shows as alert until it is turned back on, a port shed by the load budget as busy
 	for(int i = 0; i < portNum; i++)
 	{
-		(AUX_STATE_PROPERTY->items + i)->light.value = deviceFeatures[i].state;
+		if (blownFuses & (1 << i))
+			(AUX_STATE_PROPERTY->items + i)->light.value = INDIGO_ALERT_STATE;
+		else if (shedPorts & (1 << i))
+			(AUX_STATE_PROPERTY->items + i)->light.value = INDIGO_BUSY_STATE;
+		else
+			(AUX_STATE_PROPERTY->items + i)->light.value = deviceFeatures[i].state;
 	}
+	if (blownFuses)
+		AUX_STATE_PROPERTY->state = INDIGO_ALERT_STATE;
+	else if (shedPorts)
+		AUX_STATE_PROPERTY->state = INDIGO_BUSY_STATE;
+	else
+		AUX_STATE_PROPERTY->state = INDIGO_OK_STATE;
 	indigo_update_property(device,AUX_STATE_PROPERTY,NULL);
 	return INDIGO_OK;
 }
@@ -529,9 +700,10 @@ indigo_result CreateProperties(indigo_device *device){
 			return INDIGO_FAILED;
 	
 	AUX_INFO_PROPERTY = indigo_init_number_property(NULL, device->name, AUX_INFO_PROPERTY_NAME, 
-		AUX_GROUP, "Input gauges", INDIGO_OK_STATE, INDIGO_RO_PERM, 3);
+		AUX_GROUP, "Input gauges", INDIGO_OK_STATE, INDIGO_RO_PERM, 4);
 	if (AUX_INFO_PROPERTY == NULL)
 		return INDIGO_FAILED;
+	indigo_init_number_item(AUX_INFO_CHARGE_ITEM, "X_AUX_BATTERY_CHARGE", "Battery charge [%]", -1, 100, 1, batteryCharge);
 
 	AUX_PWM_MODES_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_PWM_MODES_PROPERTY", AUX_GROUP, "PWM outlet modes", INDIGO_OK_STATE, INDIGO_RW_PERM, 4);
 	if (AUX_PWM_MODES_PROPERTY == NULL)
@@ -543,28 +715,33 @@ indigo_result CreateProperties(indigo_device *device){
 
 	if(!Contains(BoardSignature,"f")) { AUX_WEATHER_PROPERTY->hidden = true; }
 	
-	int index = 0;
-	int nSwitch = 0;
-	int nPWMOffset = 0;
-	int nPWMMode = 0;
+	// the spans are built along with the items, the PWM outlet ones by ReCreatePWMPorts()
+	mpxSpan.count = aonSpan.count = currentSpan.count = modeSpan.count = offsetSpan.count = 0;
+	weatherSpan.count = inputSpan.count = 0;
 	for(int i = 0; i < nTotalFeatures; i++){
 
 		if(deviceFeatures[i].type == MPX){
 			char name[50];
-			sprintf(name,"SWITCH_PORT_ITEM_%d",nSwitch + 1);
-			indigo_init_switch_item((AUX_SWITCH_POWER_OUTLETS_PROPERTY->items + nSwitch),name,
+			indigo_item *item = AUX_SWITCH_POWER_OUTLETS_PROPERTY->items + mpxSpan.count;
+			sprintf(name,"SWITCH_PORT_ITEM_%d",mpxSpan.count + 1);
+			indigo_init_switch_item(item,name,
 			(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value, deviceFeatures[i].value);
-			nSwitch++;
+			SpanAdd(&mpxSpan, i, item);
+		}
+
+		if(deviceFeatures[i].type == AON && aonSpan.count < AUX_ALWAYS_ON_PORTS_PROPERTY->count){
+			SpanAdd(&aonSpan, i, AUX_ALWAYS_ON_PORTS_PROPERTY->items + aonSpan.count);
 		}
 
 		if(deviceFeatures[i].type == CURRENT){
 			char name[50];
-			sprintf(name,"CURRENT_SENSOR_%d",index + 1);
+			indigo_item *item = AUX_CURRENT_SENSOR_PROPERTY->items + currentSpan.count;
+			sprintf(name,"CURRENT_SENSOR_%d",currentSpan.count + 1);
 
-			indigo_init_number_item((AUX_CURRENT_SENSOR_PROPERTY->items + index),
-			name,(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + index)->text.value,deviceFeatures[i].minvalue,
+			indigo_init_number_item(item,
+			name,(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + currentSpan.count)->text.value,deviceFeatures[i].minvalue,
 			deviceFeatures[i].maxvalue,0.1,deviceFeatures[i].value);
-			index++;
+			SpanAdd(&currentSpan, i, item);
 		}
 
 		if(deviceFeatures[i].type == TEMP){
@@ -572,6 +749,7 @@ indigo_result CreateProperties(indigo_device *device){
 			"AUX_WEATHER_TEMPERATURE_ITEM_NAME",deviceFeatures[i].name,
 			deviceFeatures[i].minvalue, deviceFeatures[i].maxvalue,0.1,
 			deviceFeatures[i].value);
+			SpanAdd(&weatherSpan, i, AUX_WEATHER_TEMPERATURE_ITEM);
 		}
 
 		if(deviceFeatures[i].type == HUMID){
@@ -579,58 +757,61 @@ indigo_result CreateProperties(indigo_device *device){
 			"AUX_WEATHER_HUMIDITY_ITEM_NAME",deviceFeatures[i].name,
 			deviceFeatures[i].minvalue, deviceFeatures[i].maxvalue,
 			0.1,deviceFeatures[i].value);
+			SpanAdd(&weatherSpan, i, AUX_WEATHER_HUMIDITY_ITEM);
 		}
 
 		if(deviceFeatures[i].type == DEWPOINT){
 			indigo_init_number_item(AUX_WEATHER_DEWPOINT_ITEM,
 			"AUX_WEATHER_DEWPOINT_ITEM_NAME",deviceFeatures[i].name,deviceFeatures[i].minvalue,
 			deviceFeatures[i].maxvalue,0.1,deviceFeatures[i].value);
+			SpanAdd(&weatherSpan, i, AUX_WEATHER_DEWPOINT_ITEM);
 		}
 
 		if(deviceFeatures[i].type == PRESSURE){
 			indigo_init_number_item(AUX_WEATHER_PRESSURE_ITEM,
 			"AUX_WEATHER_PRESSURE_ITEM_NAME",deviceFeatures[i].name,deviceFeatures[i].minvalue,
 			deviceFeatures[i].maxvalue,0.1,deviceFeatures[i].value);
+			SpanAdd(&weatherSpan, i, AUX_WEATHER_PRESSURE_ITEM);
 		}
 
-		double power = 0.0;
 		if(deviceFeatures[i].type == INPUTA){
 			indigo_init_number_item(AUX_INFO_CURRENT_ITEM, AUX_INFO_CURRENT_ITEM_NAME, 
 			deviceFeatures[i].name, 0, 20, 0.1,deviceFeatures[i].value);
-			power = deviceFeatures[i].value;
+			SpanAdd(&inputSpan, i, AUX_INFO_CURRENT_ITEM);
 		}
 
 		if(deviceFeatures[i].type == INPUTV){
 			indigo_init_number_item(AUX_INFO_VOLTAGE_ITEM, AUX_INFO_VOLTAGE_ITEM_NAME, 
 			deviceFeatures[i].name, 0, 20, 0.1,deviceFeatures[i].value);
-			power = power * deviceFeatures[i].value;
+			SpanAdd(&inputSpan, i, AUX_INFO_VOLTAGE_ITEM);
 		}
 
-		indigo_init_number_item(AUX_INFO_POWER_ITEM, AUX_INFO_POWER_ITEM_NAME, 
-			"Power [W]", 0, 200, 0.1, power);
-
 		if (deviceFeatures[i].type == MODE)
 		{
 			char name[50];
 			char label[200];
-			sprintf(name,"AUX_PWM_MODE_ITEM_%d",nPWMMode + 1);
-			sprintf(label,"PWM %d mode\n0: variable, 1:on/off, 2: dew heater, 3: temperature PID",nPWMMode + 1);
-			indigo_init_number_item((AUX_PWM_MODES_PROPERTY->items + nPWMMode),name, 
+			indigo_item *item = AUX_PWM_MODES_PROPERTY->items + modeSpan.count;
+			sprintf(name,"AUX_PWM_MODE_ITEM_%d",modeSpan.count + 1);
+			sprintf(label,"PWM %d mode\n0: variable, 1:on/off, 2: dew heater, 3: temperature PID",modeSpan.count + 1);
+			indigo_init_number_item(item,name, 
 			label,0,3,1,deviceFeatures[i].value);
-			nPWMMode++;
+			SpanAdd(&modeSpan, i, item);
 		}	
 		
 		if (deviceFeatures[i].type == SETTEMP)
 		{
 			char name[50];
 			char label[200];
-			sprintf(name,"AUX_PWM_TEMP_OFFSET_ITEM_%d",nPWMOffset + 1);
-			sprintf(label,"PWM temperature offset %d",nPWMMode + 1);
-			indigo_init_number_item((AUX_PWM_TEMP_OFFSETS_PROPERTY->items + nPWMOffset),
+			indigo_item *item = AUX_PWM_TEMP_OFFSETS_PROPERTY->items + offsetSpan.count;
+			sprintf(name,"AUX_PWM_TEMP_OFFSET_ITEM_%d",offsetSpan.count + 1);
+			sprintf(label,"PWM temperature offset %d",offsetSpan.count + 1);
+			indigo_init_number_item(item,
 			name, label,0,10,1,deviceFeatures[i].value);
-			nPWMOffset++;
+			SpanAdd(&offsetSpan, i, item);
 		}
 	}
+	indigo_init_number_item(AUX_INFO_POWER_ITEM, AUX_INFO_POWER_ITEM_NAME, 
+		"Power [W]", 0, 200, 0.1, AUX_INFO_CURRENT_ITEM->number.value * AUX_INFO_VOLTAGE_ITEM->number.value);
 
 	indigo_define_property(device,AUX_SWITCH_POWER_OUTLETS_PROPERTY,NULL);
 	indigo_update_property(device,AUX_SWITCH_POWER_OUTLETS_PROPERTY,NULL);
@@ -647,83 +828,412 @@ indigo_result CreateProperties(indigo_device *device){
 }
 void QueryDeviceStatus(indigo_device *device);
 
-indigo_result UpdatePWMModeItems(indigo_device *device){
-	
-	int nItem = 0;
-	for(int i = 0; i < nTotalFeatures; i++){
-		if(deviceFeatures[i].type == MODE){
-			(AUX_PWM_MODES_PROPERTY->items + nItem)->number.value = deviceFeatures[i].value;
-			nItem++;
+/// Reads back the calibration of every ADC channel: one per port then the input current and voltage
+/// the device converts raw ADC counts to milli-units with ((raw * gain) >> 10) + offset
+indigo_result QueryCalibration(indigo_device *device)
+{
+	int channels = portNum + 2;
+
+	AUX_CALIBRATION_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_CALIBRATION_PROPERTY",
+		AUX_GROUP, "Sensor calibration", INDIGO_OK_STATE, INDIGO_RO_PERM, channels * 2);
+	if (AUX_CALIBRATION_PROPERTY == NULL)
+		return INDIGO_FAILED;
+
+	for (int i = 0; i < channels; i++)
+	{
+		char command[20];
+		char response[50] = {0};
+		char name[50];
+		char label[INDIGO_VALUE_SIZE];
+		const char *channel;
+		long gain = 0;
+		long offset = 0;
+
+		sprintf(command, ">L:%02d#", i);
+		if (!pbex_command(device, command, response, sizeof(response)) ||
+			sscanf(response, ">L:%*d:%ld:%ld#", &gain, &offset) != 2)
+		{
+			INDIGO_DRIVER_ERROR(DRIVER_NAME, "QueryCalibration Invalid response from device: %s", response);
 		}
+		if (i < portNum)
+			channel = (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value;
+		else if (i == portNum)
+			channel = "Input current";
+		else
+			channel = "Input voltage";
+
+		sprintf(name, "CALIBRATION_GAIN_%d", i + 1);
+		snprintf(label, sizeof(label), "%s gain [milli-units/count]", channel);
+		indigo_init_number_item(AUX_CALIBRATION_PROPERTY->items + i * 2, name, label, -1000, 1000, 0.001, gain / 1024.0);
+		sprintf(name, "CALIBRATION_OFFSET_%d", i + 1);
+		snprintf(label, sizeof(label), "%s offset [milli-units]", channel);
+		indigo_init_number_item(AUX_CALIBRATION_PROPERTY->items + i * 2 + 1, name, label, -100000, 100000, 1, offset);
+		INDIGO_DRIVER_DEBUG(DRIVER_NAME, "QueryCalibration channel %d gain %ld offset %ld", i, gain, offset);
 	}
+	indigo_define_property(device, AUX_CALIBRATION_PROPERTY, NULL);
 
-	return indigo_update_property(device,AUX_PWM_MODES_PROPERTY,NULL);
+	return INDIGO_OK;
 }
-indigo_result UpdateSwitchItems(indigo_device *device)
+
+/// Reads the electronic fuse of every port: instantaneous trip and rated current in mA, I2t budget in A2s
+indigo_result QueryFuses(indigo_device *device)
 {
-	int nSwitch = 0;
-	for(int i = 0; i < portNum; i++){
-		if(deviceFeatures[i].type == MPX){
+	AUX_FUSE_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_FUSE_PROPERTY",
+		AUX_GROUP, "Port fuses", INDIGO_OK_STATE, INDIGO_RW_PERM, portNum * 3);
+	if (AUX_FUSE_PROPERTY == NULL)
+		return INDIGO_FAILED;
 
-			(AUX_SWITCH_POWER_OUTLETS_PROPERTY->items + nSwitch)->sw.value = deviceFeatures[i].value;
-			nSwitch++;
+	for (int i = 0; i < portNum; i++)
+	{
+		char command[20];
+		char response[50] = {0};
+		char name[50];
+		char label[INDIGO_VALUE_SIZE];
+		const char *port = (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value;
+		unsigned int trip = 0;
+		unsigned int rated = 0;
+		unsigned int i2t = 0;
+
+		sprintf(command, ">J:%02d#", i);
+		if (!pbex_command(device, command, response, sizeof(response)) ||
+			sscanf(response, ">J:%*d:%u:%u:%u#", &trip, &rated, &i2t) != 3)
+		{
+			INDIGO_DRIVER_ERROR(DRIVER_NAME, "QueryFuses Invalid response from device: %s", response);
 		}
+		sprintf(name, "FUSE_TRIP_%d", i + 1);
+		snprintf(label, sizeof(label), "%s trip [mA]", port);
+		indigo_init_number_item(AUX_FUSE_PROPERTY->items + i * 3, name, label, 100, 65535, 100, trip);
+		sprintf(name, "FUSE_RATED_%d", i + 1);
+		snprintf(label, sizeof(label), "%s rated [mA]", port);
+		indigo_init_number_item(AUX_FUSE_PROPERTY->items + i * 3 + 1, name, label, 100, 65535, 100, rated);
+		sprintf(name, "FUSE_I2T_%d", i + 1);
+		snprintf(label, sizeof(label), "%s I2t [A2s]", port);
+		indigo_init_number_item(AUX_FUSE_PROPERTY->items + i * 3 + 2, name, label, 1, 65535, 1, i2t);
 	}
+	indigo_define_property(device, AUX_FUSE_PROPERTY, NULL);
 
-	return indigo_update_property(device,AUX_SWITCH_POWER_OUTLETS_PROPERTY,NULL);
+	return INDIGO_OK;
 }
-indigo_result UpdateDisplayItems(indigo_device *device)
+
+/// Reads a scalar setting of the device by id, see the U and V commands
+long QueryParam(indigo_device *device, int id)
 {
-	QueryDeviceStatus(device);
-	int index = 0;
-	int nAON = 0;
-	int nTempOffset = 0;
-	for(int i = 0; i < nTotalFeatures; i++){
+	char command[20];
+	char response[50] = {0};
+	long value = 0;
 
-		if(deviceFeatures[i].type == CURRENT){
-			(AUX_CURRENT_SENSOR_PROPERTY->items + index)->number.value = deviceFeatures[i].value;
-			index++;
-		}
+	sprintf(command, ">V:%02d#", id);
+	if (!pbex_command(device, command, response, sizeof(response)) || sscanf(response, ">V:%*d:%ld#", &value) != 1)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "QueryParam Invalid response from device: %s", response);
+	}
+	return value;
+}
 
-		if(deviceFeatures[i].type == AON){
-			(AUX_ALWAYS_ON_PORTS_PROPERTY->items + nAON)->number.value = deviceFeatures[i].value;
-			nAON++;
-		}
+/// Writes a scalar setting of the device by id
+bool SetParam(indigo_device *device, int id, long value)
+{
+	char command[30];
+	char response[50] = {0};
 
-		if(deviceFeatures[i].type == SETTEMP){
-			(AUX_PWM_TEMP_OFFSETS_PROPERTY->items + nTempOffset)->number.value = deviceFeatures[i].value;
-			nTempOffset++;
-		}
+	sprintf(command, ">U:%02d:%ld#", id, value);
+	if (!pbex_command(device, command, response, sizeof(response)) || strcmp(response, ">UOK#") != 0)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "SetParam Invalid response from device: %s", response);
+		return false;
+	}
+	return true;
+}
 
-		if(deviceFeatures[i].type == TEMP){
-			AUX_WEATHER_TEMPERATURE_ITEM->number.value = deviceFeatures[i].value;
-		}
+/// Reads the input current budget used for load shedding
+indigo_result QueryBudget(indigo_device *device)
+{
+	AUX_BUDGET_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_BUDGET_PROPERTY",
+		AUX_GROUP, "Load shedding", INDIGO_OK_STATE, INDIGO_RW_PERM, 2);
+	if (AUX_BUDGET_PROPERTY == NULL)
+		return INDIGO_FAILED;
 
-		if(deviceFeatures[i].type == HUMID){
-			AUX_WEATHER_HUMIDITY_ITEM->number.value = deviceFeatures[i].value;
-		}
+	indigo_init_number_item(AUX_BUDGET_CURRENT_ITEM, "BUDGET_CURRENT", "Input current budget [mA], 0 disables", 0, 100000, 100, QueryParam(device, PARAM_BUDGET));
+	indigo_init_number_item(AUX_BUDGET_HEADROOM_ITEM, "BUDGET_HEADROOM", "Headroom before restoring [mA]", 0, 100000, 100, QueryParam(device, PARAM_HEADROOM));
+	indigo_define_property(device, AUX_BUDGET_PROPERTY, NULL);
 
-		if(deviceFeatures[i].type == PRESSURE){
-			AUX_WEATHER_PRESSURE_ITEM->number.value = deviceFeatures[i].value;
-		}
+	return INDIGO_OK;
+}
 
-		if(deviceFeatures[i].type == DEWPOINT){
-			AUX_WEATHER_DEWPOINT_ITEM->number.value = deviceFeatures[i].value;
-		}
+/// Reads the low voltage disconnect and battery settings, item n is the scalar setting PARAM_LVDCUT + n
+indigo_result QueryBattery(indigo_device *device)
+{
+	static const char *names[] = { "BATTERY_LVD_CUT", "BATTERY_LVD_RESTORE", "BATTERY_CAPACITY", "BATTERY_EMPTY", "BATTERY_FULL", "BATTERY_RESISTANCE" };
+	static const char *labels[] = { "Low voltage disconnect [mV], 0 disables", "Restore above [mV]", "Capacity [mAh], 0 disables", "Empty rest voltage [mV]", "Full rest voltage [mV]", "Internal resistance [mOhm]" };
+	// the device refuses a capacity over MAXCAPACITY and a resistance over MAXRESIST
+	static const double maxima[] = { 1000000, 1000000, 1000000, 1000000, 1000000, 10000 };
+	int count = sizeof(names) / sizeof(names[0]);
+
+	AUX_BATTERY_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_BATTERY_PROPERTY",
+		AUX_GROUP, "Battery", INDIGO_OK_STATE, INDIGO_RW_PERM, count);
+	if (AUX_BATTERY_PROPERTY == NULL)
+		return INDIGO_FAILED;
 
-		if(deviceFeatures[i].type == INPUTA){
-			AUX_INFO_CURRENT_ITEM->number.value = deviceFeatures[i].value;
-		}
+	for (int i = 0; i < count; i++)
+	{
+		indigo_init_number_item(AUX_BATTERY_PROPERTY->items + i, names[i], labels[i], 0, maxima[i], 1, QueryParam(device, PARAM_LVDCUT + i));
+	}
+	indigo_define_property(device, AUX_BATTERY_PROPERTY, NULL);
 
-		if(deviceFeatures[i].type == INPUTV){
-			AUX_INFO_VOLTAGE_ITEM->number.value = deviceFeatures[i].value;
+	return INDIGO_OK;
+}
+
+/// Reads a PWM timer setup '>g:<timer>:<clock>:<bits>:<hz>#', timer is 1 or 2
+bool QueryPwmTimer(indigo_device *device, int timer, int *clock, int *bits)
+{
+	char command[20];
+	char response[50] = {0};
+
+	sprintf(command, ">g:%d#", timer);
+	if (!pbex_command(device, command, response, sizeof(response)) || sscanf(response, ">g:%*d:%d:%d", clock, bits) != 2)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "QueryPwmTimer Invalid response from device: %s", response);
+		return false;
+	}
+	return true;
+}
+
+/// Reads the PWM phase staggering and the frequency setup of the adjustable timers
+indigo_result QueryPwmTimers(indigo_device *device)
+{
+	int clock2 = 0, clock1 = 0, bits = 16, unused;
+
+	AUX_PWM_TIMER_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_PWM_TIMER_PROPERTY",
+		AUX_GROUP, "PWM timers", INDIGO_OK_STATE, INDIGO_RW_PERM, 4);
+	if (AUX_PWM_TIMER_PROPERTY == NULL)
+		return INDIGO_FAILED;
+
+	QueryPwmTimer(device, 2, &clock2, &unused);
+	QueryPwmTimer(device, 1, &clock1, &bits);
+	indigo_init_number_item(AUX_PWM_STAGGER_ITEM, "PWM_STAGGER", "Stagger the PWM phases, 0: aligned, 1: staggered", 0, 1, 1, QueryParam(device, PARAM_PWMPHASE));
+	indigo_init_number_item(AUX_PWM_TIMER2_CLOCK_ITEM, "TIMER2_CLOCK", "D3 clock, 0: default, 1: 62.5kHz, 2: 7.8kHz, 3: 1.95kHz, 4: 976Hz, 5: 488Hz, 6: 244Hz, 7: 61Hz", 0, 7, 1, clock2);
+	indigo_init_number_item(AUX_PWM_TIMER1_CLOCK_ITEM, "TIMER1_CLOCK", "D9 clock prescaler, 0: default, 1: 1, 2: 8, 3: 64, 4: 256, 5: 1024", 0, 5, 1, clock1);
+	indigo_init_number_item(AUX_PWM_TIMER1_BITS_ITEM, "TIMER1_BITS", "D9 resolution [bits]", 8, 16, 1, bits);
+	indigo_define_property(device, AUX_PWM_TIMER_PROPERTY, NULL);
+
+	return INDIGO_OK;
+}
+
+/// Creates the PID auto-tune properties, writing a PWM port number starts its auto-tune, -1 aborts
+indigo_result QueryAutotune(indigo_device *device)
+{
+	AUX_AUTOTUNE_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_AUTOTUNE_PROPERTY",
+		AUX_GROUP, "PID auto-tune", INDIGO_OK_STATE, INDIGO_RW_PERM, 1);
+	AUX_AUTOTUNE_STATUS_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_AUTOTUNE_STATUS_PROPERTY",
+		AUX_GROUP, "PID auto-tune status", INDIGO_OK_STATE, INDIGO_RO_PERM, 6);
+	if (AUX_AUTOTUNE_PROPERTY == NULL || AUX_AUTOTUNE_STATUS_PROPERTY == NULL)
+		return INDIGO_FAILED;
+
+	indigo_init_number_item(AUX_AUTOTUNE_PORT_ITEM, "TUNE_PORT", "PWM port in temperature PID mode, -1 aborts", -1, portNum - 1, 1, -1);
+	indigo_init_number_item(AUX_AUTOTUNE_CYCLE_ITEM, "TUNE_CYCLE", "Oscillation cycles", 0, 255, 1, 0);
+	indigo_init_number_item(AUX_AUTOTUNE_PERIOD_ITEM, "TUNE_PERIOD", "Oscillation period [s]", 0, 100000, 1, 0);
+	indigo_init_number_item(AUX_AUTOTUNE_AMPLITUDE_ITEM, "TUNE_AMPLITUDE", "Oscillation amplitude [C]", 0, 100, 0.01, 0);
+	indigo_init_number_item(AUX_AUTOTUNE_KP_ITEM, "TUNE_KP", "Tuned Kp", 0, 100000, 0.001, 0);
+	indigo_init_number_item(AUX_AUTOTUNE_KI_ITEM, "TUNE_KI", "Tuned Ki [1/s]", 0, 100000, 0.001, 0);
+	indigo_init_number_item(AUX_AUTOTUNE_KD_ITEM, "TUNE_KD", "Tuned Kd [s]", 0, 100000, 0.001, 0);
+	tuneState = -1;
+	indigo_define_property(device, AUX_AUTOTUNE_PROPERTY, NULL);
+	indigo_define_property(device, AUX_AUTOTUNE_STATUS_PROPERTY, NULL);
+
+	return INDIGO_OK;
+}
+
+/// Reads the auto-tune progress '>Z:<port>:<state>:<cycle>:<period>:<amplitude>#' and the gains once it is done
+void UpdateAutotune(indigo_device *device)
+{
+	char command[20];
+	char response[100] = {0};
+	int port, state, cycle;
+	long period, amplitude, kp, ki, kd;
+
+	if (!pbex_command(device, GETTUNE, response, sizeof(response)) ||
+		sscanf(response, ">Z:%d:%d:%d:%ld:%ld#", &port, &state, &cycle, &period, &amplitude) != 5)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "UpdateAutotune Invalid response from device: %s", response);
+		return;
+	}
+	if (state != TUNE_RUNNING && state == tuneState)
+		return;
+
+	AUX_AUTOTUNE_CYCLE_ITEM->number.value = cycle;
+	AUX_AUTOTUNE_PERIOD_ITEM->number.value = period;
+	AUX_AUTOTUNE_AMPLITUDE_ITEM->number.value = amplitude / 100.0;
+	if (state == TUNE_DONE)
+	{
+		sprintf(command, ">B:%02d#", port);
+		if (pbex_command(device, command, response, sizeof(response)) &&
+			sscanf(response, ">B:%*d:%*u:%ld:%ld:%ld", &kp, &ki, &kd) == 3)
+		{
+			AUX_AUTOTUNE_KP_ITEM->number.value = kp / 1000.0;
+			AUX_AUTOTUNE_KI_ITEM->number.value = ki / 1000.0;
+			AUX_AUTOTUNE_KD_ITEM->number.value = kd / 1000.0;
+		}
+		else
+		{
+			INDIGO_DRIVER_ERROR(DRIVER_NAME, "UpdateAutotune Invalid response from device: %s", response);
 		}
+	}
+	if (state == TUNE_RUNNING)
+		AUX_AUTOTUNE_STATUS_PROPERTY->state = INDIGO_BUSY_STATE;
+	else if (state == TUNE_FAILED)
+		AUX_AUTOTUNE_STATUS_PROPERTY->state = INDIGO_ALERT_STATE;
+	else
+		AUX_AUTOTUNE_STATUS_PROPERTY->state = INDIGO_OK_STATE;
+	tuneState = state;
+	indigo_update_property(device, AUX_AUTOTUNE_STATUS_PROPERTY, NULL);
+}
 
+/// Appends one '<count>:<total>:<min>:<max>' timing of the t reply to a text item, times in us
+static void AppendTiming(indigo_item *item, const char *label, char **fields)
+{
+	size_t used = strlen(item->text.value);
+	long count = atol(fields[0]);
 
-		AUX_INFO_POWER_ITEM->number.value = AUX_INFO_CURRENT_ITEM->number.value * 
-		AUX_INFO_VOLTAGE_ITEM->number.value;
+	if (count == 0)
+		snprintf(item->text.value + used, INDIGO_VALUE_SIZE - used, "%s%s%snone", used ? ", " : "", label, *label ? ": " : "");
+	else
+		snprintf(item->text.value + used, INDIGO_VALUE_SIZE - used, "%s%s%s%ld x %ld us (%s - %s us)", used ? ", " : "", label, *label ? ": " : "",
+			count, atol(fields[1]) / count, fields[2], fields[3]);
+}
+
+/// Reads the loop timing '>t:<gap>:<idle>:<read>:<dew>:<swap>:<probes>:<commands>#' into the timing items,
+/// a firmware built with TIMINGDETAIL follows it with ':<each probe>:<letter>:<timing> of each command seen'
+/// a timing is '<count>:<total>:<min>:<max>' in us
+static bool ReadTiming(indigo_device *device)
+{
+	char response[2048] = {0};
+	char label[10];
+	char *words[256];
+	char *cursor = response;
+	char *end;
+	int count = 0;
+	int nProbes = strlen(BoardSignature) - portNum;
+	int detail = 2 + 6 * 4;
+	int commands = detail + nProbes * 4;
+	indigo_item *states[] = { AUX_TIMING_IDLE_ITEM, AUX_TIMING_READ_ITEM, AUX_TIMING_DEW_ITEM, AUX_TIMING_SWAP_ITEM };
+
+	if (!pbex_command(device, GETTIMING, response, sizeof(response) - 1) || strncmp(response, ">t:", 3) != 0)
+		return false;
+	if ((end = strchr(response, '#')) != NULL)
+		*end = '\0';
+	while (cursor != NULL && count < 256)
+		words[count++] = strsep(&cursor, ":");
+	if (count != detail && (count < commands || (count - commands) % 5 != 0))
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "ReadTiming timing does not match the signature %s", BoardSignature);
+		return false;
+	}
+
+	snprintf(AUX_TIMING_GAP_ITEM->text.value, INDIGO_VALUE_SIZE, "%s us", words[1]);
+	for (int i = 0; i < 4; i++)
+	{
+		*states[i]->text.value = '\0';
+		AppendTiming(states[i], "", words + 2 + i * 4);
+	}
+	// the probe and command lists are cut at the item size
+	*AUX_TIMING_PROBES_ITEM->text.value = '\0';
+	AppendTiming(AUX_TIMING_PROBES_ITEM, "all", words + 18);
+	*AUX_TIMING_COMMANDS_ITEM->text.value = '\0';
+	AppendTiming(AUX_TIMING_COMMANDS_ITEM, "all", words + 22);
+	if (count == detail)
+		return true;
+	for (int i = 0; i < nProbes; i++)
+	{
+		snprintf(label, sizeof(label), "%d", i + 1);
+		AppendTiming(AUX_TIMING_PROBES_ITEM, label, words + detail + i * 4);
+	}
+	for (int i = commands; i < count; i += 5)
+		AppendTiming(AUX_TIMING_COMMANDS_ITEM, words[i], words + i + 1);
+	return true;
+}
+
+/// Creates the loop timing properties, only on firmware that reports it
+indigo_result QueryTiming(indigo_device *device)
+{
+	AUX_TIMING_PROPERTY = indigo_init_text_property(NULL, device->name, "AUX_TIMING_PROPERTY",
+		AUX_GROUP, "Loop timing", INDIGO_OK_STATE, INDIGO_RO_PERM, 7);
+	AUX_TIMING_CLEAR_PROPERTY = indigo_init_switch_property(NULL, device->name, "AUX_TIMING_CLEAR_PROPERTY",
+		AUX_GROUP, "Loop timing reset", INDIGO_OK_STATE, INDIGO_RW_PERM, INDIGO_AT_MOST_ONE_RULE, 1);
+	if (AUX_TIMING_PROPERTY == NULL || AUX_TIMING_CLEAR_PROPERTY == NULL)
+		return INDIGO_FAILED;
+
+	indigo_init_text_item(AUX_TIMING_GAP_ITEM, "TIMING_GAP", "Longest loop", "");
+	indigo_init_text_item(AUX_TIMING_IDLE_ITEM, "TIMING_IDLE", "Idle state", "");
+	indigo_init_text_item(AUX_TIMING_READ_ITEM, "TIMING_READ", "Read state", "");
+	indigo_init_text_item(AUX_TIMING_DEW_ITEM, "TIMING_DEW", "Dew state", "");
+	indigo_init_text_item(AUX_TIMING_SWAP_ITEM, "TIMING_SWAP", "Swap state", "");
+	indigo_init_text_item(AUX_TIMING_PROBES_ITEM, "TIMING_PROBES", "Probe reads", "");
+	indigo_init_text_item(AUX_TIMING_COMMANDS_ITEM, "TIMING_COMMANDS", "Commands", "");
+	indigo_init_switch_item(AUX_TIMING_CLEAR_ITEM, "TIMING_CLEAR", "Clear", false);
+	gettimeofday(&PRIVATE_DATA->timing_stamp, NULL);
+	haveTiming = ReadTiming(device);
+	if (!haveTiming)
+	{
+		INDIGO_DRIVER_LOG(DRIVER_NAME, "The firmware does not report its loop timing");
+		return INDIGO_OK;
+	}
+	indigo_define_property(device, AUX_TIMING_PROPERTY, NULL);
+	indigo_define_property(device, AUX_TIMING_CLEAR_PROPERTY, NULL);
+
+	return INDIGO_OK;
+}
+
+/// Refreshes the loop timing every TIMINGINTERVAL
+void UpdateTiming(indigo_device *device)
+{
+	if (!haveTiming || pbex_elapsed_ms(&PRIVATE_DATA->timing_stamp) < TIMINGINTERVAL)
+		return;
+	gettimeofday(&PRIVATE_DATA->timing_stamp, NULL);
+	if (ReadTiming(device))
+		AUX_TIMING_PROPERTY->state = INDIGO_OK_STATE;
+	else
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "UpdateTiming Invalid response from device");
+		AUX_TIMING_PROPERTY->state = INDIGO_ALERT_STATE;
+	}
+	indigo_update_property(device, AUX_TIMING_PROPERTY, NULL);
+}
+
+/// Copies the feature values of a span into the items showing them
+void UpdateSpanItems(FeatureSpan *span)
+{
+	for(int i = 0; i < span->count; i++){
+		span->item[i]->number.value = deviceFeatures[span->feature[i]].value;
+	}
+}
+indigo_result UpdatePWMModeItems(indigo_device *device){
+	
+	UpdateSpanItems(&modeSpan);
+
+	return indigo_update_property(device,AUX_PWM_MODES_PROPERTY,NULL);
+}
+indigo_result UpdateSwitchItems(indigo_device *device)
+{
+	for(int i = 0; i < mpxSpan.count; i++){
+		mpxSpan.item[i]->sw.value = deviceFeatures[mpxSpan.feature[i]].value;
 	}
+
+	return indigo_update_property(device,AUX_SWITCH_POWER_OUTLETS_PROPERTY,NULL);
+}
+indigo_result UpdateDisplayItems(indigo_device *device)
+{
+	QueryDeviceStatus(device);
+	UpdateSpanItems(&currentSpan);
+	UpdateSpanItems(&aonSpan);
+	UpdateSpanItems(&offsetSpan);
+	UpdateSpanItems(&weatherSpan);
+	UpdateSpanItems(&inputSpan);
+	AUX_INFO_POWER_ITEM->number.value = AUX_INFO_CURRENT_ITEM->number.value * 
+		AUX_INFO_VOLTAGE_ITEM->number.value;
 	
+	// the state of charge comes from the extended status, the gauges turn alert while the low voltage disconnect holds ports off
+	AUX_INFO_CHARGE_ITEM->number.value = batteryCharge;
+	AUX_INFO_PROPERTY->state = lowVoltage ? INDIGO_ALERT_STATE : INDIGO_OK_STATE;
 	indigo_update_property(device,AUX_INFO_PROPERTY,NULL);
 	indigo_update_property(device,AUX_CURRENT_SENSOR_PROPERTY,NULL);
 	indigo_update_property(device,AUX_WEATHER_PROPERTY,NULL);
@@ -737,17 +1247,18 @@ indigo_result ReCreatePWMPorts(indigo_device *device)
 {
 	if(!deviceFeatures){ return INDIGO_FAILED; }
 
-	int var[4] = {-1};
-	int sw[4] = {-1};
+	int var[SPAN_SIZE] = {-1};
+	int sw[SPAN_SIZE] = {-1};
 	int numVar = 0;
 	int numSw = 0;
-	for(size_t i = 0; i < portNum; i++){
+	for(size_t i = 0; i < portNum && numVar < SPAN_SIZE && numSw < SPAN_SIZE; i++){
 		if(deviceFeatures[i].type == PWM){	
 			var[numVar++] = i;
 		}else if(deviceFeatures[i].type == SWH){
 			sw[numSw++] = i;
 		}
 	}
+	pwmSpan.count = switchSpan.count = 0;
 
 	if(numVar > 0){
 		if(AUX_PWM_POWER_OUTLETS_PROPERTY == NULL){
@@ -756,6 +1267,7 @@ indigo_result ReCreatePWMPorts(indigo_device *device)
 				return INDIGO_FAILED;
 		}else{
 			indigo_delete_property(device, AUX_PWM_POWER_OUTLETS_PROPERTY,NULL);
+			indigo_release_property(AUX_PWM_POWER_OUTLETS_PROPERTY);
 			AUX_PWM_POWER_OUTLETS_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_PWM_POWER_OUTLETS_PROPERTY", AUX_GROUP, "PWM power outlets", INDIGO_OK_STATE, INDIGO_RW_PERM, numVar);
 			if (AUX_PWM_POWER_OUTLETS_PROPERTY == NULL)
 				return INDIGO_FAILED;
@@ -767,6 +1279,7 @@ indigo_result ReCreatePWMPorts(indigo_device *device)
 			indigo_init_number_item(AUX_PWM_POWER_OUTLETS_PROPERTY->items + item, 
 			name, (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + (var[item]))->text.value, 
 			0, 255, 1, deviceFeatures[var[item]].value);
+			SpanAdd(&pwmSpan, var[item], AUX_PWM_POWER_OUTLETS_PROPERTY->items + item);
 		}		
 		indigo_define_property(device,AUX_PWM_POWER_OUTLETS_PROPERTY,NULL);
 		
@@ -784,6 +1297,7 @@ indigo_result ReCreatePWMPorts(indigo_device *device)
 				return INDIGO_FAILED;
 		}else{
 			indigo_delete_property(device, AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY,NULL);
+			indigo_release_property(AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY);
 			AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY = indigo_init_switch_property(NULL, device->name, 
 			"AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY", AUX_GROUP, "PWM Switches", INDIGO_OK_STATE, 
 			INDIGO_RW_PERM, INDIGO_ANY_OF_MANY_RULE,numSw);
@@ -799,6 +1313,7 @@ indigo_result ReCreatePWMPorts(indigo_device *device)
 			indigo_init_switch_item(AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY->items + item, 
 			name, (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + (sw[item]))->text.value,
 			deviceFeatures[sw[item]].state );
+			SpanAdd(&switchSpan, sw[item], AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY->items + item);
 		}
 		indigo_define_property(device,AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY,NULL);
 		
@@ -827,44 +1342,758 @@ indigo_result QueryPWMPorts(indigo_device *device) {
 				return INDIGO_FAILED;
 			}
 
-            int j = 0;
-            token = strtok(response, ":");
-            while (token != NULL) {
-                words[j++] = token;
-                token = strtok(NULL, ":");
-            }
-            deviceFeatures[i].value = atof(words[2]);
+            int j = 0;
+            token = strtok(response, ":");
+            while (token != NULL) {
+                words[j++] = token;
+                token = strtok(NULL, ":");
+            }
+            deviceFeatures[i].value = atof(words[2]);
+
+            if (deviceFeatures[i].value == 1) {
+                deviceFeatures[deviceFeatures[i].port - 1].type = SWH;
+                deviceFeatures[deviceFeatures[i].port - 1].maxvalue = 1;
+            }
+            deviceFeatures[i].state = true;
+            snprintf(deviceFeatures[i].name, sizeof(deviceFeatures[i].name), "%s Mode", deviceFeatures[deviceFeatures[i].port - 1].name);
+            INDIGO_DRIVER_DEBUG(DRIVER_NAME,"QueryPWMPorts switch %d mode %f", i, deviceFeatures[i].value);
+        }
+
+        if (deviceFeatures[i].type == SETTEMP) {
+            char command[50];
+            sprintf(command, ">H:%02d#", deviceFeatures[i].port - 1);
+
+			if(!pbex_command(device,command,response,sizeof(response)))
+			{
+				return INDIGO_FAILED;
+			}
+
+            int j = 0;
+            token = strtok(response, ":");
+            while (token != NULL) {
+                words[j++] = token;
+                token = strtok(NULL, ":");
+            }
+            deviceFeatures[i].value = atof(words[2]);
+            deviceFeatures[i].state = true;
+            snprintf(deviceFeatures[i].name, sizeof(deviceFeatures[i].name), "%s Temperature Offset", deviceFeatures[deviceFeatures[i].port - 1].name);
+            INDIGO_DRIVER_DEBUG(DRIVER_NAME, "QueryPWMPorts switch %d offset %f", i, deviceFeatures[i].value);
+        }
+    }
+
+	return INDIGO_OK;
+}
+/// Path of a file kept in the home directory, false if there is no home directory to keep it in
+static bool pbex_home_path(char *path, int max, const char *name)
+{
+	const char *home = getenv("HOME");
+
+	if (home == NULL)
+		return false;
+	snprintf(path, max, "%s/%s", home, name);
+	return true;
+}
+
+/// Reads the configuration dump cached on disk, only if it was taken from a device with the current description
+static bool pbex_load_layout(char *dump, int max)
+{
+	char path[256];
+	char key[128];
+	bool found = false;
+	FILE *file;
+
+	if (!pbex_home_path(path, sizeof(path), LAYOUT_CACHE) || (file = fopen(path, "r")) == NULL)
+		return false;
+	if (fgets(key, sizeof(key), file) != NULL && fgets(dump, max, file) != NULL)
+	{
+		key[strcspn(key, "\n")] = '\0';
+		dump[strcspn(dump, "\n")] = '\0';
+		found = strcmp(key, deviceDescription) == 0;
+	}
+	fclose(file);
+	return found;
+}
+
+/// Keeps the configuration dump on disk for the next start of the driver, a missing ~/.indigo just disables the cache
+static void pbex_save_layout(const char *dump)
+{
+	char path[256];
+	FILE *file;
+
+	if (!pbex_home_path(path, sizeof(path), LAYOUT_CACHE) || (file = fopen(path, "w")) == NULL)
+		return;
+	fprintf(file, "%s\n%s\n", deviceDescription, dump);
+	fclose(file);
+}
+
+/// Sends a command replied by a text header of <colons> colon terminated fields, the last one the length of the
+/// binary data that follows before the '#'. The data may hold '#' so it cannot go through pbex_command().
+/// Returns the data length, 0 for a plain text reply that ends before the data, -1 on failure
+static long pbex_read_burst(indigo_device *device, char *command, char *header, int header_max, int colons, unsigned char *data, long max)
+{
+	int length = 0;
+	int seen = 0;
+	char *field;
+	long size;
+	char end;
+
+	memset(header, 0, header_max);
+	tcflush(PRIVATE_DATA->handle, TCIOFLUSH);
+	if (!indigo_write(PRIVATE_DATA->handle, command, strlen(command)))
+		return -1;
+	while (seen < colons && length < header_max - 1)
+	{
+		if (indigo_read(PRIVATE_DATA->handle, header + length, 1) != 1)
+			return -1;
+		if (header[length] == '#')
+		{
+			INDIGO_DRIVER_DEBUG(DRIVER_NAME, "Command %s -> %s", command, header);
+			return 0;
+		}
+		if (header[length++] == ':')
+			seen++;
+	}
+	// the length is the field before the last colon
+	header[length - 1] = '\0';
+	field = strrchr(header, ':');
+	size = field != NULL ? atol(field + 1) : -1;
+	header[length - 1] = ':';
+	if (seen < colons || size < 0 || size > max)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "pbex_read_burst Invalid response from device: %s", header);
+		return -1;
+	}
+	if (indigo_read(PRIVATE_DATA->handle, (char *)data, size) != size || indigo_read(PRIVATE_DATA->handle, &end, 1) != 1 || end != '#')
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "pbex_read_burst Truncated reply from device: %s", header);
+		return -1;
+	}
+	INDIGO_DRIVER_DEBUG(DRIVER_NAME, "Command %s -> %s<%ld bytes>#", command, header, size);
+	return size;
+}
+
+/// Time of the last record of the history log, 0 for an empty log
+static double pbex_history_tail(FILE *file)
+{
+	char tail[512];
+	char *line;
+	long size;
+	int length;
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	if (size <= 0)
+		return 0;
+	length = size < sizeof(tail) - 1 ? size : sizeof(tail) - 1;
+	fseek(file, -length, SEEK_END);
+	length = fread(tail, 1, length, file);
+	tail[length] = '\0';
+	while (length > 0 && tail[length - 1] == '\n')
+		tail[--length] = '\0';
+	line = strrchr(tail, '\n');
+	return atof(line != NULL ? line + 1 : tail);
+}
+
+/// Reads the varint at pos of the history data and moves pos past it
+static unsigned long pbex_varint(const unsigned char *data, long length, long *pos)
+{
+	unsigned long value = 0;
+	int shift = 0;
+
+	while (*pos < length && shift < 32)
+	{
+		value |= (unsigned long)(data[*pos] & 0x7F) << shift;
+		shift += 7;
+		if (!(data[(*pos)++] & 0x80))
+			break;
+	}
+	return value;
+}
+
+/// Adds the changes of the history record at pos to values and moves pos past it. Returns the bitmap of the
+/// record, bit 0 set when it samples the ports and bit f+1 when field f changed, -1 past the end of the data
+static long pbex_history_record(const unsigned char *data, long length, long *pos, int fields, short *values)
+{
+	unsigned long map;
+
+	if (*pos >= length)
+		return -1;
+	map = pbex_varint(data, length, pos);
+	for (int f = 0; f < fields; f++)
+	{
+		if (map & (1UL << (f + 1)))
+		{
+			unsigned long zigzag = pbex_varint(data, length, pos);
+
+			values[f] += (short)((zigzag >> 1) ^ -(zigzag & 1));
+		}
+	}
+	return (long)map;
+}
+
+/// Downloads the telemetry history of the device and appends the records newer than the log to HISTORY_LOG,
+/// so that the log has no gap after a disconnect or a skipped poll. Returns the records appended, -1 on failure
+static int BackfillHistory(indigo_device *device)
+{
+	unsigned char data[4096];
+	char text[100];
+	long header[5]; // interval, age, records, fields, length
+	short values[HISTORY_MAXFIELDS];
+	char path[256];
+	char columns[1024];
+	char line[1024];
+	int ports = currentSpan.count;
+	int levels;
+	int fields;
+	long pos;
+	long map;
+	int appended = 0;
+	struct timeval now;
+	double stamp;
+	FILE *file;
+
+	// '>h:<interval>:<age>:<records>:<fields>:<length>:<data>#'
+	if (pbex_read_burst(device, GETHISTORY, text, sizeof(text), 6, data, sizeof(data)) <= 0 ||
+		sscanf(text, ">h:%ld:%ld:%ld:%ld:%ld:", header, header + 1, header + 2, header + 3, header + 4) != 5)
+		return -1;
+	fields = header[3];
+	levels = fields - HISTORY_FIELDS - ports;
+	if (levels < 0 || fields > HISTORY_MAXFIELDS || header[4] < fields * 2)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "BackfillHistory history of %ld fields, %d ports", header[3], ports);
+		return -1;
+	}
+	if (!pbex_home_path(path, sizeof(path), HISTORY_LOG) || (file = fopen(path, "a+")) == NULL)
+		return 0;
+	// the port columns follow the slow ones, the port currents then the PWM levels
+	pos = snprintf(columns, sizeof(columns), "%s", HISTORY_HEADER);
+	for (int i = 0; i < ports; i++)
+		pos += snprintf(columns + pos, sizeof(columns) - pos, ",Port %d current [A]", i + 1);
+	for (int i = 0; i < levels; i++)
+		pos += snprintf(columns + pos, sizeof(columns) - pos, ",PWM %d level [%%]", i + 1);
+	snprintf(columns + pos, sizeof(columns) - pos, "\n");
+	// a log started with other columns, by another firmware or a box with other ports, is moved aside
+	rewind(file);
+	if (fgets(line, sizeof(line), file) != NULL && strcmp(line, columns) != 0)
+	{
+		char old[sizeof(path) + 4];
+
+		fclose(file);
+		snprintf(old, sizeof(old), "%s.old", path);
+		rename(path, old);
+		INDIGO_DRIVER_LOG(DRIVER_NAME, "BackfillHistory log with other columns moved to %s", old);
+		historyLast = -1;
+		if ((file = fopen(path, "a+")) == NULL)
+			return 0;
+	}
+	if (historyLast < 0)
+		historyLast = pbex_history_tail(file);
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) == 0)
+		fputs(columns, file);
+
+	// each record carries the seconds since the previous one, the oldest is timed back from the newest by the
+	// sum of those of the later records, so a change of the interval does not re-time the records taken before it
+	gettimeofday(&now, NULL);
+	stamp = now.tv_sec + now.tv_usec / 1000000.0 - header[1] / 1000.0;
+	for (int f = 0; f < fields; f++)
+		values[f] = (short)(data[f * 2] | data[f * 2 + 1] << 8);
+	pos = fields * 2;
+	for (long r = 0; r < header[2] && pbex_history_record(data, header[4], &pos, fields, values) >= 0; r++)
+	{
+		if (r > 0)
+			stamp -= values[0];
+	}
+	for (int f = 0; f < fields; f++)
+		values[f] = (short)(data[f * 2] | data[f * 2 + 1] << 8);
+	pos = fields * 2;
+	for (long r = 0; r < header[2] && (map = pbex_history_record(data, header[4], &pos, fields, values)) >= 0; r++)
+	{
+		if (r > 0)
+			stamp += values[0];
+		// records already in the log are skipped, the times of a record in two downloads differ by the link latency
+		if (stamp <= historyLast + values[0] / 2.0)
+			continue;
+		fprintf(file, "%.1f", stamp);
+		// current in 10mA and voltage in 10mV, the probe readings in tenths
+		fprintf(file, ",%.2f,%.2f,%.1f,%.1f,%.1f", values[1] / 100.0, values[2] / 100.0, values[3] / 10.0, values[4] / 10.0, values[5] / 10.0);
+		// port currents in 100mA and PWM levels out of 255, only on the records that sample them
+		for (int i = 0; i < ports + levels; i++)
+		{
+			if (!(map & 1))
+				fputs(",", file);
+			else if (i < ports)
+				fprintf(file, ",%.1f", values[HISTORY_FIELDS + i] / 10.0);
+			else
+				fprintf(file, ",%.0f", values[HISTORY_FIELDS + i] * 100.0 / 255);
+		}
+		fputs("\n", file);
+		historyLast = stamp;
+		appended++;
+	}
+	fclose(file);
+	return appended;
+}
+
+/// Backfills the history log with what the device recorded while we were away, then creates the history
+/// interval property, only on firmware that records a history
+indigo_result QueryHistory(indigo_device *device)
+{
+	int appended;
+
+	gettimeofday(&PRIVATE_DATA->history_stamp, NULL);
+	appended = BackfillHistory(device);
+	haveHistory = appended >= 0;
+	if (!haveHistory)
+	{
+		INDIGO_DRIVER_LOG(DRIVER_NAME, "The firmware does not record a telemetry history");
+		return INDIGO_OK;
+	}
+	INDIGO_DRIVER_LOG(DRIVER_NAME, "Backfilled %d history records", appended);
+
+	AUX_HISTORY_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_HISTORY_PROPERTY",
+		AUX_GROUP, "Telemetry history", INDIGO_OK_STATE, INDIGO_RW_PERM, 1);
+	if (AUX_HISTORY_PROPERTY == NULL)
+		return INDIGO_FAILED;
+
+	indigo_init_number_item(AUX_HISTORY_INTERVAL_ITEM, "HISTORY_INTERVAL", "Record interval [s], 0 disables", 0, 3600, 1, QueryParam(device, PARAM_HISTORY));
+	indigo_define_property(device, AUX_HISTORY_PROPERTY, NULL);
+
+	return INDIGO_OK;
+}
+
+/// Appends the new history records to the log every HISTORYINTERVAL
+void UpdateHistory(indigo_device *device)
+{
+	if (!haveHistory || pbex_elapsed_ms(&PRIVATE_DATA->history_stamp) < HISTORYINTERVAL)
+		return;
+	gettimeofday(&PRIVATE_DATA->history_stamp, NULL);
+	BackfillHistory(device);
+}
+
+/// Maps the record file, or a new one with a zero size when <reset>
+static pbex_record_header *pbex_map_record(const char *path, size_t size, bool reset)
+{
+	pbex_record_header *header;
+	int handle = open(path, O_RDWR | O_CREAT | (reset ? O_TRUNC : 0), 0644);
+
+	if (handle < 0)
+		return NULL;
+	if (ftruncate(handle, size) < 0)
+	{
+		close(handle);
+		return NULL;
+	}
+	header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	// the mapping holds its own reference to the file
+	close(handle);
+	return header == MAP_FAILED ? NULL : header;
+}
+
+/// The port states, PWM modes and temperature offsets are recorded as their last read, the mean of an on/off state
+/// or a mode is not one of its values
+static bool pbex_record_mean(short type)
+{
+	return type != SWH && type != MPX && type != AON && type != MODE && type != SETTEMP;
+}
+
+/// The currents also get a column for their peak, a short inrush or overload vanishes in the mean of a minute
+static bool pbex_record_peak(short type)
+{
+	return type == CURRENT || type == INPUTA;
+}
+
+/// Maps RECORD_FILE, a file recorded from another layout is kept aside as RECORD_FILE.old and a new one started
+static bool OpenRecorder(indigo_device *device)
+{
+	char path[256];
+	char old[270];
+	size_t size = RECORD_MAX_SIZE;
+	uint32_t fields = nTotalFeatures;
+	uint32_t record_size;
+	uint32_t capacity;
+	pbex_record_header *header;
+
+	for (int i = 0; i < nTotalFeatures; i++)
+		fields += pbex_record_peak(deviceFeatures[i].type);
+	fields = fields < PBEX_RECORD_FIELDS ? fields : PBEX_RECORD_FIELDS;
+	record_size = PBEX_RECORD_SIZE(fields);
+	capacity = (RECORD_MAX_SIZE - PBEX_RECORD_OFFSET) / record_size;
+	if (!pbex_home_path(path, sizeof(path), RECORD_FILE) || (header = pbex_map_record(path, size, false)) == NULL)
+		return false;
+	if (memcmp(header->magic, PBEX_RECORD_MAGIC, sizeof(header->magic)) == 0 && header->record_size == record_size &&
+		header->capacity == capacity && header->fields == fields && strcmp(header->signature, BoardSignature) == 0)
+	{
+		INDIGO_DRIVER_LOG(DRIVER_NAME, "Recording to %s after %llu records", path, (unsigned long long)header->written);
+		PRIVATE_DATA->record = header;
+		return true;
+	}
+	if (header->written > 0)
+	{
+		munmap(header, size);
+		snprintf(old, sizeof(old), "%s.old", path);
+		rename(path, old);
+		INDIGO_DRIVER_LOG(DRIVER_NAME, "The record file is from another device layout, moved to %s", old);
+		if ((header = pbex_map_record(path, size, true)) == NULL)
+			return false;
+	}
+	memset(header, 0, sizeof(pbex_record_header));
+	header->record_size = record_size;
+	header->capacity = capacity;
+	header->fields = fields;
+	snprintf(header->signature, sizeof(header->signature), "%s", BoardSignature);
+	for (uint32_t i = 0, peak = nTotalFeatures; i < nTotalFeatures; i++)
+	{
+		if (i < fields)
+			snprintf(header->names[i], PBEX_RECORD_NAME, "%s", deviceFeatures[i].name);
+		if (pbex_record_peak(deviceFeatures[i].type) && peak < fields)
+			snprintf(header->names[peak++], PBEX_RECORD_NAME, "%.26s peak", deviceFeatures[i].name);
+	}
+	// the magic goes last so that a half initialized file is not taken as valid
+	__sync_synchronize();
+	memcpy(header->magic, PBEX_RECORD_MAGIC, sizeof(header->magic));
+	INDIGO_DRIVER_LOG(DRIVER_NAME, "Recording to new %s, %u records of %u values, %.0f days", path, capacity, fields,
+		(double)capacity * RECORD_INTERVAL / 86400000.0);
+	PRIVATE_DATA->record = header;
+	return true;
+}
+
+/// Adds the values just read by QueryDeviceStatus() to the record appended to the record file every RECORD_INTERVAL,
+/// the page cache writes it back
+static void RecordStatus(indigo_device *device)
+{
+	pbex_record_header *header = PRIVATE_DATA->record;
+	double *sum = PRIVATE_DATA->record_sum;
+	pbex_record *record;
+	struct timeval now;
+
+	if (header == NULL)
+	{
+		if (PRIVATE_DATA->record_failed || deviceFeatures == NULL)
+			return;
+		PRIVATE_DATA->record_failed = !OpenRecorder(device);
+		if (PRIVATE_DATA->record_failed)
+		{
+			INDIGO_DRIVER_ERROR(DRIVER_NAME, "RecordStatus cannot map %s: %s", RECORD_FILE, strerror(errno));
+			return;
+		}
+		header = PRIVATE_DATA->record;
+		memset(PRIVATE_DATA->record_sum, 0, sizeof(PRIVATE_DATA->record_sum));
+		PRIVATE_DATA->record_reads = 0;
+		gettimeofday(&PRIVATE_DATA->record_stamp, NULL);
+	}
+	// the peak columns follow the features, in the order of the currents
+	for (uint32_t i = 0, peak = nTotalFeatures; i < nTotalFeatures; i++)
+	{
+		double value = deviceFeatures[i].value;
+
+		if (i < header->fields)
+			sum[i] = pbex_record_mean(deviceFeatures[i].type) ? sum[i] + value : value;
+		if (!pbex_record_peak(deviceFeatures[i].type) || peak >= header->fields)
+			continue;
+		if (PRIVATE_DATA->record_reads == 0 || fabs(value) > fabs(sum[peak]))
+			sum[peak] = value;
+		peak++;
+	}
+	PRIVATE_DATA->record_reads++;
+	if (pbex_elapsed_ms(&PRIVATE_DATA->record_stamp) < RECORD_INTERVAL)
+		return;
+	record = PBEX_RECORD(header, header->written);
+	// a reader skips the slot while its time is 0
+	record->time = 0;
+	__sync_synchronize();
+	for (uint32_t i = 0; i < header->fields; i++)
+	{
+		bool mean = i < nTotalFeatures && pbex_record_mean(deviceFeatures[i].type);
+
+		record->value[i] = mean ? sum[i] / PRIVATE_DATA->record_reads : sum[i];
+		sum[i] = 0;
+	}
+	PRIVATE_DATA->record_reads = 0;
+	gettimeofday(&now, NULL);
+	PRIVATE_DATA->record_stamp = now;
+	__sync_synchronize();
+	record->time = now.tv_sec + now.tv_usec / 1000000.0;
+	__sync_synchronize();
+	header->written++;
+}
+
+/// Unmaps the record file, it is opened again by the first status read of the next connection
+static void CloseRecorder(indigo_device *device)
+{
+	if (PRIVATE_DATA->record != NULL)
+		munmap(PRIVATE_DATA->record, RECORD_MAX_SIZE);
+	PRIVATE_DATA->record = NULL;
+	PRIVATE_DATA->record_failed = false;
+}
+
+/// Maps the PBEX_SHM_NAME segment and publishes the layout of the device in it, a segment left by a previous run
+/// is reused so that the readers which still map it see the new layout
+static bool OpenPublisher(indigo_device *device)
+{
+	pbex_shm_segment *segment;
+	uint32_t fields = nTotalFeatures < PBEX_RECORD_FIELDS ? nTotalFeatures : PBEX_RECORD_FIELDS;
+	int handle = shm_open(PBEX_SHM_NAME, O_RDWR | O_CREAT, 0644);
+
+	if (handle < 0)
+		return false;
+	if (ftruncate(handle, sizeof(pbex_shm_segment)) < 0)
+	{
+		close(handle);
+		return false;
+	}
+	segment = mmap(NULL, sizeof(pbex_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	close(handle);
+	if (segment == MAP_FAILED)
+		return false;
+	// a driver that died while it wrote left the sequence odd, the readers retry until it is even again
+	__atomic_store_n(&segment->sequence, (segment->sequence | 1) + 1, __ATOMIC_RELEASE);
+	pbex_shm_write_begin(segment);
+	segment->size = sizeof(pbex_shm_segment);
+	segment->fields = fields;
+	snprintf(segment->signature, sizeof(segment->signature), "%s", BoardSignature);
+	memset(segment->names, 0, sizeof(segment->names));
+	for (uint32_t i = 0; i < fields; i++)
+		snprintf(segment->names[i], PBEX_RECORD_NAME, "%s", deviceFeatures[i].name);
+	memset(&segment->status, 0, sizeof(segment->status));
+	memcpy(segment->magic, PBEX_SHM_MAGIC, sizeof(segment->magic));
+	pbex_shm_write_end(segment);
+	INDIGO_DRIVER_LOG(DRIVER_NAME, "Publishing the status of %u values in %s", fields, PBEX_SHM_NAME);
+	PRIVATE_DATA->shm = segment;
+	return true;
+}
+
+/// Publishes the values just read by QueryDeviceStatus(), the readers never wait on the driver nor the driver on them
+static void PublishStatus(indigo_device *device)
+{
+	pbex_shm_segment *segment = PRIVATE_DATA->shm;
+	struct timeval now;
+
+	if (segment == NULL)
+	{
+		if (PRIVATE_DATA->shm_failed || deviceFeatures == NULL)
+			return;
+		PRIVATE_DATA->shm_failed = !OpenPublisher(device);
+		if (PRIVATE_DATA->shm_failed)
+		{
+			INDIGO_DRIVER_ERROR(DRIVER_NAME, "PublishStatus cannot map %s: %s", PBEX_SHM_NAME, strerror(errno));
+			return;
+		}
+		segment = PRIVATE_DATA->shm;
+	}
+	gettimeofday(&now, NULL);
+	pbex_shm_write_begin(segment);
+	for (uint32_t i = 0; i < segment->fields; i++)
+		segment->status.value[i] = deviceFeatures[i].value;
+	segment->status.time = now.tv_sec + now.tv_usec / 1000000.0;
+	pbex_shm_write_end(segment);
+}
+
+/// Tells the readers there is no device any more and unmaps the segment, it stays for them to map
+static void ClosePublisher(indigo_device *device)
+{
+	pbex_shm_segment *segment = PRIVATE_DATA->shm;
+
+	if (segment != NULL)
+	{
+		pbex_shm_write_begin(segment);
+		segment->fields = 0;
+		pbex_shm_write_end(segment);
+		munmap(segment, sizeof(pbex_shm_segment));
+	}
+	PRIVATE_DATA->shm = NULL;
+	PRIVATE_DATA->shm_failed = false;
+}
+
+/// Creates the scope capture settings and the BLOB the waveform is published in, only on firmware with the scope
+indigo_result QueryScope(indigo_device *device)
+{
+	char response[50] = {0};
+
+	haveScope = pbex_command(device, GETSCOPE, response, sizeof(response)) && strncmp(response, ">c:", 3) == 0;
+	if (!haveScope)
+	{
+		INDIGO_DRIVER_LOG(DRIVER_NAME, "The firmware does not capture waveforms");
+		return INDIGO_OK;
+	}
+
+	AUX_SCOPE_PROPERTY = indigo_init_number_property(NULL, device->name, "AUX_SCOPE_PROPERTY",
+		AUX_GROUP, "Scope capture", INDIGO_OK_STATE, INDIGO_RW_PERM, 5);
+	if (AUX_SCOPE_PROPERTY == NULL)
+		return INDIGO_FAILED;
+	indigo_init_number_item(AUX_SCOPE_PORT_ITEM, "SCOPE_PORT", "Port whose current is captured", 0, portNum - 1, 1, 0);
+	indigo_init_number_item(AUX_SCOPE_INPUTS_ITEM, "SCOPE_INPUTS", "Also capture input voltage (1), current (2)", 0, 3, 1, 0);
+	indigo_init_number_item(AUX_SCOPE_TRIGGER_ITEM, "SCOPE_TRIGGER", "Port current trigger [mA], 0 triggers at once", 0, 20000, 10, 0);
+	indigo_init_number_item(AUX_SCOPE_PRE_ITEM, "SCOPE_PRE", "Pre-trigger share of the capture [%]", 0, 100, 1, 25);
+	indigo_init_number_item(AUX_SCOPE_DECIMATE_ITEM, "SCOPE_DECIMATE", "Record one ADC pass out of", 1, 255, 1, 1);
+	indigo_define_property(device, AUX_SCOPE_PROPERTY, NULL);
+
+	AUX_SCOPE_BLOB_PROPERTY = indigo_init_blob_property(NULL, device->name, "AUX_SCOPE_BLOB_PROPERTY",
+		AUX_GROUP, "Scope waveform", INDIGO_OK_STATE, 1);
+	if (AUX_SCOPE_BLOB_PROPERTY == NULL)
+		return INDIGO_FAILED;
+	indigo_init_blob_item(AUX_SCOPE_BLOB_ITEM, "SCOPE_CAPTURE", "Waveform CSV");
+	indigo_define_property(device, AUX_SCOPE_BLOB_PROPERTY, NULL);
+
+	return INDIGO_OK;
+}
+
+/// Converts a capture to CSV with the calibration of its channels into the scope BLOB,
+/// one row per frame with the time from the trigger [us] and the voltage [V] or currents [A]
+static bool ScopeToBlob(indigo_device *device, char *header, unsigned char *data, long length)
+{
+	int state, port, channels, pre, frames, depth;
+	long period;
+	int calibration[3];
+	int count = 0;
+	char *csv;
+	long size = 0;
+	long max;
+
+	// '>c:<state>:<port>:<channels>:<period>:<pre>:<frames>:<length>:'
+	if (sscanf(header, ">c:%d:%d:%d:%ld:%d:%d:%d:", &state, &port, &channels, &period, &pre, &frames, &depth) != 7 ||
+		port >= portNum || frames <= 0 || depth != length || depth % frames != 0)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "ScopeToBlob Invalid capture header: %s", header);
+		return false;
+	}
+	// the samples of a frame are in ADC channel order: input voltage, input current, port current
+	if (channels & 1)
+		calibration[count++] = portNum + 1;
+	if (channels & 2)
+		calibration[count++] = portNum;
+	if (channels & 4)
+		calibration[count++] = port;
+	if (count != depth / frames)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "ScopeToBlob Channels %d do not match the frame size", channels);
+		return false;
+	}
+
+	max = 64 + frames * (16 + count * 12);
+	csv = indigo_safe_realloc(AUX_SCOPE_BLOB_ITEM->blob.value, max);
+	AUX_SCOPE_BLOB_ITEM->blob.value = csv;
+	size += snprintf(csv + size, max - size, "time_us");
+	if (channels & 1)
+		size += snprintf(csv + size, max - size, ",input_v");
+	if (channels & 2)
+		size += snprintf(csv + size, max - size, ",input_a");
+	size += snprintf(csv + size, max - size, ",port%d_a\n", port + 1);
+	for (int f = 0; f < frames; f++)
+	{
+		size += snprintf(csv + size, max - size, "%.1f", (f - pre) * period / 10.0);
+		for (int c = 0; c < count; c++)
+		{
+			// the samples are the top 8 bits of the 10 bit reading
+			double gain = (AUX_CALIBRATION_PROPERTY->items + calibration[c] * 2)->number.value;
+			double offset = (AUX_CALIBRATION_PROPERTY->items + calibration[c] * 2 + 1)->number.value;
+			size += snprintf(csv + size, max - size, ",%.3f", ((data[f * count + c] << 2) * gain + offset) / 1000.0);
+		}
+		size += snprintf(csv + size, max - size, "\n");
+	}
+	AUX_SCOPE_BLOB_ITEM->blob.size = size;
+	strcpy(AUX_SCOPE_BLOB_ITEM->blob.format, ".csv");
+	return true;
+}
+
+/// Polls a running capture and publishes the waveform once the device is done
+void UpdateScope(indigo_device *device)
+{
+	char text[100];
+	unsigned char data[256];
+	long length;
+	int state = -1;
 
-            if (deviceFeatures[i].value == 1) {
-                deviceFeatures[deviceFeatures[i].port - 1].type = SWH;
-                deviceFeatures[deviceFeatures[i].port - 1].maxvalue = 1;
-            }
-            deviceFeatures[i].state = true;
-            snprintf(deviceFeatures[i].name, sizeof(deviceFeatures[i].name), "%s Mode", deviceFeatures[deviceFeatures[i].port - 1].name);
-            INDIGO_DRIVER_DEBUG(DRIVER_NAME,"QueryPWMPorts switch %d mode %f", i, deviceFeatures[i].value);
-        }
+	if (!haveScope || AUX_SCOPE_PROPERTY->state != INDIGO_BUSY_STATE)
+		return;
+	length = pbex_read_burst(device, GETSCOPE, text, sizeof(text), 8, data, sizeof(data));
+	if (length == 0 && sscanf(text, ">c:%d#", &state) == 1 && state != 0 && state != 5)
+		return; // settling, armed or triggered
+	if (length > 0 && ScopeToBlob(device, text, data, length))
+	{
+		AUX_SCOPE_PROPERTY->state = INDIGO_OK_STATE;
+		AUX_SCOPE_BLOB_PROPERTY->state = INDIGO_OK_STATE;
+		indigo_update_property(device, AUX_SCOPE_BLOB_PROPERTY, NULL);
+		indigo_update_property(device, AUX_SCOPE_PROPERTY, NULL);
+		return;
+	}
+	if (state == 5)
+		indigo_send_message(device, "Scope capture timed out waiting for the trigger");
+	AUX_SCOPE_PROPERTY->state = INDIGO_ALERT_STATE;
+	indigo_update_property(device, AUX_SCOPE_PROPERTY, NULL);
+}
 
-        if (deviceFeatures[i].type == SETTEMP) {
-            char command[50];
-            sprintf(command, ">H:%02d#", deviceFeatures[i].port - 1);
+/// Populates the port names and PWM port settings from a single configuration dump
+/// '>d:<signature>:<name of each port>:<mode>:<offset>:<preset> of each PWM port:<type>:<mux port> of each probe#'
+/// fails on firmware without the dump so that the caller falls back to QueryPWMPorts()
+indigo_result QueryConfigDump(indigo_device *device)
+{
+	char response[512] = {0};
+	char reply[512];
+	bool cached = pbex_load_layout(response, sizeof(response));
+	char *words[128];
+	char *cursor = response;
+	char *end;
+	int count = 0;
+	int firstPWM = GetFirstIndexOf(portsonly, 'p', 0);
+	int nPWM = GetNUMPWMPorts(portsonly);
+	int nProbes = strlen(BoardSignature) - portNum;
 
-			if(!pbex_command(device,command,response,sizeof(response)))
+	if (!cached && (!pbex_command(device, GETDUMP, response, sizeof(response) - 1) || strncmp(response, ">d:", 3) != 0))
+	{
+		INDIGO_DRIVER_DEBUG(DRIVER_NAME, "QueryConfigDump no dump from the device");
+		return INDIGO_FAILED;
+	}
+	strcpy(reply, response);
+	if ((end = strchr(response, '#')) != NULL)
+		*end = '\0';
+	// port names may be empty so the fields are split with strsep() which keeps them
+	while (cursor != NULL && count < 128)
+		words[count++] = strsep(&cursor, ":");
+	if (count != 2 + portNum + nPWM * 3 + nProbes * 2 || strcmp(words[1], BoardSignature) != 0)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "QueryConfigDump dump does not match the signature %s", BoardSignature);
+		return INDIGO_FAILED;
+	}
+
+	for (int i = 0; i < portNum; i++)
+	{
+		if (*words[2 + i] == '\0')
+			continue;
+		snprintf(deviceFeatures[i].name, sizeof(deviceFeatures[i].name), "%s", words[2 + i]);
+		snprintf(deviceFeatures[i + portNum].name, sizeof(deviceFeatures[i + portNum].name), "%s Current (A)", words[2 + i]);
+	}
+	for (int i = 0; i < nTotalFeatures; i++)
+	{
+		int pwm = deviceFeatures[i].port - 1 - firstPWM;
+		char **settings = words + 2 + portNum + pwm * 3;
+
+		if (deviceFeatures[i].type == MODE)
+		{
+			deviceFeatures[i].value = atof(settings[0]);
+			if (deviceFeatures[i].value == 1)
 			{
-				return INDIGO_FAILED;
+				deviceFeatures[deviceFeatures[i].port - 1].type = SWH;
+				deviceFeatures[deviceFeatures[i].port - 1].maxvalue = 1;
 			}
-
-            int j = 0;
-            token = strtok(response, ":");
-            while (token != NULL) {
-                words[j++] = token;
-                token = strtok(NULL, ":");
-            }
-            deviceFeatures[i].value = atof(words[2]);
-            deviceFeatures[i].state = true;
-            snprintf(deviceFeatures[i].name, sizeof(deviceFeatures[i].name), "%s Temperature Offset", deviceFeatures[deviceFeatures[i].port - 1].name);
-            INDIGO_DRIVER_DEBUG(DRIVER_NAME, "QueryPWMPorts switch %d offset %f", i, deviceFeatures[i].value);
-        }
-    }
+			deviceFeatures[i].state = true;
+			snprintf(deviceFeatures[i].name, sizeof(deviceFeatures[i].name), "%s Mode", deviceFeatures[deviceFeatures[i].port - 1].name);
+			INDIGO_DRIVER_DEBUG(DRIVER_NAME, "QueryConfigDump switch %d mode %f preset %s", i, deviceFeatures[i].value, settings[2]);
+		}
+		if (deviceFeatures[i].type == SETTEMP)
+		{
+			deviceFeatures[i].value = atof(settings[1]);
+			deviceFeatures[i].state = true;
+			snprintf(deviceFeatures[i].name, sizeof(deviceFeatures[i].name), "%s Temperature Offset", deviceFeatures[deviceFeatures[i].port - 1].name);
+			INDIGO_DRIVER_DEBUG(DRIVER_NAME, "QueryConfigDump switch %d offset %f", i, deviceFeatures[i].value);
+		}
+	}
+	for (int i = 0; i < nProbes; i++)
+		INDIGO_DRIVER_DEBUG(DRIVER_NAME, "QueryConfigDump probe %d type %s mux port %s", i, words[2 + portNum + nPWM * 3 + i * 2], words[3 + portNum + nPWM * 3 + i * 2]);
+	if (cached)
+		INDIGO_DRIVER_LOG(DRIVER_NAME, "Configuration read from the layout cache");
+	else
+		pbex_save_layout(reply);
 
 	return INDIGO_OK;
 }
@@ -880,6 +2109,7 @@ Feature *QueryDeviceDescription(indigo_device *device)
 	{
 		char words[4][128]; // Array to store split substrings
 
+		strcpy(deviceDescription, response);
 		char *token = strtok(response, ":"); // Split the string based on colon ':'
 		int count = 0;
 		while (token != NULL && count < 4 /*sanity check*/)
@@ -1336,6 +2566,8 @@ void QueryDeviceStatus(indigo_device *device)
 					p++;
 				}
 			}
+			RecordStatus(device);
+			PublishStatus(device);
 		}
 	}
 	else
@@ -1404,34 +2636,116 @@ static bool pbex_command(indigo_device *device, char *command, char *response, i
 	return true;
 }
 
-static void pbex_open(indigo_device *device)
+static void pbex_set_speed(indigo_device *device, speed_t speed)
+{
+	struct termios options;
+
+	tcgetattr(PRIVATE_DATA->handle, &options);
+	cfsetispeed(&options, speed);
+	cfsetospeed(&options, speed);
+	tcsetattr(PRIVATE_DATA->handle, TCSANOW, &options);
+}
+
+/// Round trip of a ping in ms, -1 if the device does not answer
+static double pbex_ping_ms(indigo_device *device)
+{
+	char response[20] = {0};
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+	if (!pbex_command(device, PINGCOMMAND, response, sizeof(response)) || strcmp(response, PINGREPLY) != 0)
+		return -1;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+}
+
+/// Moves the link to NEGOTIATED_BAUD: the device acks at 9600, both sides switch and a ping at the
+/// new rate confirms it. Without the ping the device falls back to 9600 after BAUD_VERIFY ms, and so do we.
+static void pbex_negotiate_baud(indigo_device *device)
+{
+	char command[20];
+	char response[20] = {0};
+	long baud = 0;
+	double slow = pbex_ping_ms(device);
+	double fast;
+
+	sprintf(command, ">b:%d#", NEGOTIATED_BAUD);
+	if (!pbex_command(device, command, response, sizeof(response)) || sscanf(response, ">b:%ld#", &baud) != 1 || baud != NEGOTIATED_BAUD)
+	{
+		INDIGO_DRIVER_LOG(DRIVER_NAME, "Device stays at 9600 baud (%s), ping %.1f ms", response, slow);
+		return;
+	}
+	pbex_set_speed(device, NEGOTIATED_SPEED);
+	indigo_usleep(10000);
+	fast = pbex_ping_ms(device);
+	if (fast < 0)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "No ping at %d baud, falling back to 9600", NEGOTIATED_BAUD);
+		pbex_set_speed(device, B9600);
+		indigo_usleep((BAUD_VERIFY + 500) * 1000);
+		tcflush(PRIVATE_DATA->handle, TCIOFLUSH);
+		return;
+	}
+	INDIGO_DRIVER_LOG(DRIVER_NAME, "Serial link at %d baud, ping %.1f ms (%.1f ms at 9600)", NEGOTIATED_BAUD, fast, slow);
+}
+
+static double pbex_elapsed_ms(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/// Opening the port resets the board: wait for the '>D:...#' banner it sends once setup() is done,
+/// or for the reply to a ping sent with an exponential backoff when nothing comes in
+static bool pbex_wait_ready(indigo_device *device)
 {
 	char response[128];
-	PRIVATE_DATA->handle = indigo_open_serial(DEVICE_PORT_ITEM->text.value);
-	if (PRIVATE_DATA->handle > 0)
+	int backoff = BOOT_BACKOFF;
+	struct timeval start, wait;
+	fd_set readout;
+
+	gettimeofday(&start, NULL);
+	while (pbex_elapsed_ms(&start) < BOOT_TIMEOUT)
 	{
-		int attempt = 0;
-		while (true)
+		FD_ZERO(&readout);
+		FD_SET(PRIVATE_DATA->handle, &readout);
+		wait.tv_sec = backoff / 1000;
+		wait.tv_usec = (backoff % 1000) * 1000;
+		if (select(PRIVATE_DATA->handle + 1, &readout, NULL, NULL, &wait) > 0)
 		{
-			if (pbex_command(device, PINGCOMMAND, response, 5))
-			{ // 5 is number of bytes in >POK#
-
-				if (strncmp(response, ">POK#", 5) == 0)
-				{
-					INDIGO_DRIVER_ERROR(DRIVER_NAME, "Connected to PBEX %s", DEVICE_PORT_ITEM->text.value);
-					PRIVATE_DATA->version = 1;
-					break;
-				}
-			}
-			if (attempt++ == 3)
+			// a partial line or boot noise is dropped and we keep listening
+			if (indigo_read_line_local(PRIVATE_DATA->handle, response, sizeof(response) - 1) > 0 &&
+				(strncmp(response, ">D:", 3) == 0 || strcmp(response, PINGREPLY) == 0))
 			{
-
-				INDIGO_DRIVER_ERROR(DRIVER_NAME, "PBEX not detected");
-				break;
+				INDIGO_DRIVER_LOG(DRIVER_NAME, "PBEX ready after %.0f ms (%s)", pbex_elapsed_ms(&start), response);
+				// let the reply to a ping still in flight arrive, pbex_command() flushes it
+				indigo_usleep(50000);
+				return true;
 			}
+			continue;
+		}
+		indigo_write(PRIVATE_DATA->handle, PINGCOMMAND, strlen(PINGCOMMAND));
+		backoff = backoff * 2 > BOOT_BACKOFF_MAX ? BOOT_BACKOFF_MAX : backoff * 2;
+	}
+	return false;
+}
 
-			INDIGO_DRIVER_ERROR(DRIVER_NAME, "PBEX not detected - retrying in 5 seconds...");
-			indigo_usleep(ONE_SECOND_DELAY * 5);
+static void pbex_open(indigo_device *device)
+{
+	PRIVATE_DATA->handle = indigo_open_serial(DEVICE_PORT_ITEM->text.value);
+	if (PRIVATE_DATA->handle > 0)
+	{
+		if (pbex_wait_ready(device))
+		{
+			INDIGO_DRIVER_ERROR(DRIVER_NAME, "Connected to PBEX %s", DEVICE_PORT_ITEM->text.value);
+			PRIVATE_DATA->version = 1;
+			pbex_negotiate_baud(device);
+		}
+		else
+		{
+			INDIGO_DRIVER_ERROR(DRIVER_NAME, "PBEX not detected");
 		}
 	}
 }
@@ -1535,6 +2849,34 @@ static indigo_result aux_enumerate_properties(indigo_device *device, indigo_clie
 		if (indigo_property_match(AUX_STATE_PROPERTY, property))
 			indigo_define_property(device, AUX_STATE_PROPERTY, NULL);
 
+		if (indigo_property_match(AUX_CALIBRATION_PROPERTY, property))
+			indigo_define_property(device, AUX_CALIBRATION_PROPERTY, NULL);
+
+		if (indigo_property_match(AUX_FUSE_PROPERTY, property))
+			indigo_define_property(device, AUX_FUSE_PROPERTY, NULL);
+
+		if (indigo_property_match(AUX_BUDGET_PROPERTY, property))
+			indigo_define_property(device, AUX_BUDGET_PROPERTY, NULL);
+
+		if (indigo_property_match(AUX_BATTERY_PROPERTY, property))
+			indigo_define_property(device, AUX_BATTERY_PROPERTY, NULL);
+		if (indigo_property_match(AUX_PWM_TIMER_PROPERTY, property))
+			indigo_define_property(device, AUX_PWM_TIMER_PROPERTY, NULL);
+		if (indigo_property_match(AUX_AUTOTUNE_PROPERTY, property))
+			indigo_define_property(device, AUX_AUTOTUNE_PROPERTY, NULL);
+		if (indigo_property_match(AUX_AUTOTUNE_STATUS_PROPERTY, property))
+			indigo_define_property(device, AUX_AUTOTUNE_STATUS_PROPERTY, NULL);
+		if (haveHistory && indigo_property_match(AUX_HISTORY_PROPERTY, property))
+			indigo_define_property(device, AUX_HISTORY_PROPERTY, NULL);
+		if (haveScope && indigo_property_match(AUX_SCOPE_PROPERTY, property))
+			indigo_define_property(device, AUX_SCOPE_PROPERTY, NULL);
+		if (haveScope && indigo_property_match(AUX_SCOPE_BLOB_PROPERTY, property))
+			indigo_define_property(device, AUX_SCOPE_BLOB_PROPERTY, NULL);
+		if (haveTiming && indigo_property_match(AUX_TIMING_PROPERTY, property))
+			indigo_define_property(device, AUX_TIMING_PROPERTY, NULL);
+		if (haveTiming && indigo_property_match(AUX_TIMING_CLEAR_PROPERTY, property))
+			indigo_define_property(device, AUX_TIMING_CLEAR_PROPERTY, NULL);
+
 	}
 	if (indigo_property_match(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY, property))
 		indigo_define_property(device, AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY, NULL);
@@ -1547,14 +2889,83 @@ static void aux_timer_callback(indigo_device *device)
 		return;
 
 	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	QueryPowerEvents(device);
+	UpdateAutotune(device);
+	UpdateTiming(device);
+	UpdateHistory(device);
+	UpdateScope(device);
 	UpdateDisplayItems(device);
 	UpdateStateItems(device);
 	indigo_reschedule_timer(device, UPDATEINTERVAL / 1000, &PRIVATE_DATA->aux_timer);
 	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
 }
 
+/// True if the device still reports the description the cached layout was built from,
+/// the description carries a hash of the port names and PWM port settings
+static bool LayoutUnchanged(indigo_device *device)
+{
+	char response[128] = {0};
+
+	return deviceFeatures != NULL && pbex_command(device, GETDESCRIPTION, response, sizeof(response) - 1) &&
+		strcmp(response, deviceDescription) == 0;
+}
+
+/// Defines the properties of the cached layout again after a reconnect, their items are up to date
+static void DefineLayout(indigo_device *device)
+{
+	indigo_property *layout[] = { AUX_SWITCH_POWER_OUTLETS_PROPERTY, AUX_INFO_PROPERTY, AUX_WEATHER_PROPERTY,
+		AUX_CURRENT_SENSOR_PROPERTY, AUX_PWM_MODES_PROPERTY, AUX_PWM_TEMP_OFFSETS_PROPERTY, AUX_STATE_PROPERTY };
+
+	for (int i = 0; i < sizeof(layout) / sizeof(layout[0]); i++)
+		indigo_define_property(device, layout[i], NULL);
+	// only one of the PWM outlet properties may be in use depending on the port modes, let it sort them out
+	ReCreatePWMPorts(device);
+}
+
+/// Drops the cached layout so that it is built again from the device
+static void ReleaseLayout(indigo_device *device)
+{
+	indigo_property **layout[] = { &AUX_SWITCH_POWER_OUTLETS_PROPERTY, &AUX_INFO_PROPERTY, &AUX_WEATHER_PROPERTY,
+		&AUX_CURRENT_SENSOR_PROPERTY, &AUX_PWM_MODES_PROPERTY, &AUX_PWM_TEMP_OFFSETS_PROPERTY, &AUX_STATE_PROPERTY,
+		&AUX_PWM_POWER_OUTLETS_PROPERTY, &AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY };
+
+	for (int i = 0; i < sizeof(layout) / sizeof(layout[0]); i++)
+	{
+		indigo_release_property(*layout[i]);
+		*layout[i] = NULL;
+	}
+	if (deviceFeatures)
+	{
+		free(deviceFeatures);
+		deviceFeatures = NULL;
+	}
+}
+
+/// Releases the properties built from the device settings at each connection, the next connection reads them again
+static void ReleaseSettings(indigo_device *device)
+{
+	indigo_property **settings[] = { &AUX_CALIBRATION_PROPERTY, &AUX_FUSE_PROPERTY, &AUX_BUDGET_PROPERTY, &AUX_BATTERY_PROPERTY,
+		&AUX_PWM_TIMER_PROPERTY, &AUX_AUTOTUNE_PROPERTY, &AUX_AUTOTUNE_STATUS_PROPERTY, &AUX_HISTORY_PROPERTY,
+		&AUX_SCOPE_PROPERTY, &AUX_SCOPE_BLOB_PROPERTY, &AUX_TIMING_PROPERTY, &AUX_TIMING_CLEAR_PROPERTY };
+
+	// the waveform buffer belongs to the driver, not to the property
+	if (AUX_SCOPE_BLOB_PROPERTY != NULL)
+	{
+		free(AUX_SCOPE_BLOB_ITEM->blob.value);
+		AUX_SCOPE_BLOB_ITEM->blob.value = NULL;
+	}
+	for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+	{
+		indigo_release_property(*settings[i]);
+		*settings[i] = NULL;
+	}
+}
+
 static void aux_connection_handler(indigo_device *device)
 {
+	struct timeval start;
+
+	gettimeofday(&start, NULL);
 	indigo_lock_master_device(device);
 	pthread_mutex_lock(&PRIVATE_DATA->mutex);
 	if (CONNECTION_CONNECTED_ITEM->sw.value)
@@ -1567,17 +2978,39 @@ static void aux_connection_handler(indigo_device *device)
 		if (PRIVATE_DATA->handle > 0)
 		{
 			indigo_define_property(device, AUX_ALWAYS_ON_PORTS_PROPERTY, NULL);
-			QueryDeviceStatus(device);
-			if (deviceFeatures == NULL)
+			// after a reconnect to the same device with the same settings the layout is still valid
+			if (LayoutUnchanged(device))
+			{
+				INDIGO_DRIVER_LOG(DRIVER_NAME, "Reusing the layout of %s", deviceDescription);
+				QueryDeviceStatus(device);
+				DefineLayout(device);
+			}
+			else
 			{
-				deviceFeatures = QueryDeviceDescription(device);
+				ReleaseLayout(device);
+				QueryDeviceStatus(device);
+				if (deviceFeatures == NULL)
+				{
+					deviceFeatures = QueryDeviceDescription(device);
+				}
+				// one round trip for the names and PWM port settings, one per setting on older firmware
+				if (QueryConfigDump(device) != INDIGO_OK)
+					QueryPWMPorts(device);
+
+				CreateProperties(device);
+				CreateStateItems(device);
+				UpdatePWMModeItems(device);
+				ReCreatePWMPorts(device);
 			}
-			QueryPWMPorts(device);
-				
-			CreateProperties(device);
-			CreateStateItems(device);
-			UpdatePWMModeItems(device);
-			ReCreatePWMPorts(device);
+			QueryCalibration(device);
+			QueryFuses(device);
+			QueryBudget(device);
+			QueryBattery(device);
+			QueryPwmTimers(device);
+			QueryAutotune(device);
+			QueryTiming(device);
+			QueryHistory(device);
+			QueryScope(device);
 
 			strcpy(INFO_DEVICE_MODEL_ITEM->text.value, deviceName);
 			strcpy(INFO_DEVICE_FW_REVISION_ITEM->text.value, "Unknown");
@@ -1586,6 +3019,7 @@ static void aux_connection_handler(indigo_device *device)
 
 			indigo_set_timer(device, 0, aux_timer_callback, &PRIVATE_DATA->aux_timer);
 			CONNECTION_PROPERTY->state = INDIGO_OK_STATE;
+			INDIGO_DRIVER_LOG(DRIVER_NAME, "Time to connected %.0f ms", pbex_elapsed_ms(&start));
 		}
 		else
 		{
@@ -1598,6 +3032,8 @@ static void aux_connection_handler(indigo_device *device)
 	else
 	{
 		indigo_cancel_timer_sync(device, &PRIVATE_DATA->aux_timer);
+		CloseRecorder(device);
+		ClosePublisher(device);
 
 		indigo_delete_property(device, AUX_SWITCH_POWER_OUTLETS_PROPERTY, NULL);
 		indigo_delete_property(device, AUX_PWM_POWER_OUTLETS_PROPERTY, NULL);
@@ -1609,16 +3045,26 @@ static void aux_connection_handler(indigo_device *device)
 		indigo_delete_property(device, AUX_INFO_PROPERTY, NULL);
 		indigo_delete_property(device, AUX_STATE_PROPERTY, NULL);
 		indigo_delete_property(device, AUX_ALWAYS_ON_PORTS_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_CALIBRATION_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_FUSE_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_BUDGET_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_BATTERY_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_PWM_TIMER_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_AUTOTUNE_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_AUTOTUNE_STATUS_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_HISTORY_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_SCOPE_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_SCOPE_BLOB_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_TIMING_PROPERTY, NULL);
+		indigo_delete_property(device, AUX_TIMING_CLEAR_PROPERTY, NULL);
+		ReleaseSettings(device);
 
 		strcpy(INFO_DEVICE_MODEL_ITEM->text.value, "Unknown");
 		strcpy(INFO_DEVICE_FW_REVISION_ITEM->text.value, "Unknown");
 		strcpy(INFO_DEVICE_HW_REVISION_ITEM->text.value,"Unknown");
 		indigo_update_property(device, INFO_PROPERTY, NULL);
 
-		if(deviceFeatures){
-			free(deviceFeatures);
-			deviceFeatures = NULL;
-		}
+		// deviceFeatures and the properties are kept for the next connection
 		if (--PRIVATE_DATA->count == 0)
 		{
 			if (PRIVATE_DATA->handle > 0)
@@ -1641,17 +3087,11 @@ static void aux_power_outlet_handler(indigo_device *device)
 
 	if (deviceFeatures)
 	{
-		int iNPort = 0;
-		for (size_t i = 0; i < portNum; i++)
+		for (int i = 0; i < mpxSpan.count; i++)
 		{
-			if (deviceFeatures[i].type == MPX)
+			if ((bool)deviceFeatures[mpxSpan.feature[i]].value != mpxSpan.item[i]->sw.value)
 			{
-				if ((bool)deviceFeatures[i].value !=
-					(AUX_SWITCH_POWER_OUTLETS_PROPERTY->items + iNPort)->sw.value)
-				{
-					SetSwitchValue(device, i, (AUX_SWITCH_POWER_OUTLETS_PROPERTY->items + iNPort)->sw.value);
-				}
-				iNPort++;
+				SetSwitchValue(device, mpxSpan.feature[i], mpxSpan.item[i]->sw.value);
 			}
 		}
 
@@ -1666,22 +3106,11 @@ static void aux_pwm_configuration_handler(indigo_device *device)
 {
 	pthread_mutex_lock(&PRIVATE_DATA->mutex);
 	AUX_PWM_MODES_PROPERTY->state = INDIGO_OK_STATE;
-	// get the index of PWM
-	//
-	int index = -1;
-	for (int i = 0; (i < nTotalFeatures) && (index < 0); i++)
-	{
-		if(deviceFeatures[i].type == MODE){ index = i; }
-	}
-	for(int i = 0; i < AUX_PWM_MODES_PROPERTY->count; i++)
+	for(int i = 0; i < modeSpan.count; i++)
 	{
-		if(deviceFeatures[index + i].value != (AUX_PWM_MODES_PROPERTY->items + i)->number.value){
-			SetSwitchValue(device,index + i,
-			(AUX_PWM_MODES_PROPERTY->items + i)->number.value);
+		if(deviceFeatures[modeSpan.feature[i]].value != modeSpan.item[i]->number.value){
+			SetSwitchValue(device, modeSpan.feature[i], modeSpan.item[i]->number.value);
 		}
-		// skip temp offset
-		//
-		index++;
 	}
 	ReCreatePWMPorts(device);
 	indigo_update_property(device, AUX_PWM_MODES_PROPERTY, NULL);
@@ -1695,15 +3124,10 @@ static void aux_temp_offset_handler(indigo_device *device)
 	
 	if (deviceFeatures)
 	{
-		int iNPort = 0;
-		for (size_t i = 0; i < nTotalFeatures; i++)
+		for (int i = 0; i < offsetSpan.count; i++)
 		{
-			if (deviceFeatures[i].type == SETTEMP)
-			{
-				if(deviceFeatures[i].value != (AUX_PWM_TEMP_OFFSETS_PROPERTY->items + iNPort)->number.value){
-					SetSwitchValue(device, i, (AUX_PWM_TEMP_OFFSETS_PROPERTY->items + iNPort)->number.value);
-				}
-				iNPort++;
+			if(deviceFeatures[offsetSpan.feature[i]].value != offsetSpan.item[i]->number.value){
+				SetSwitchValue(device, offsetSpan.feature[i], offsetSpan.item[i]->number.value);
 			}
 		}
 	}
@@ -1717,15 +3141,10 @@ static void aux_pwm_switch_power_outlet_handler(indigo_device *device)
 	pthread_mutex_lock(&PRIVATE_DATA->mutex);
 	if (deviceFeatures)
 	{
-		int iNPort = 0;
-		for (size_t i = 0; i < portNum; i++)
+		for (int i = 0; i < switchSpan.count; i++)
 		{
-			if (deviceFeatures[i].type == SWH)
-			{
-				if((bool)deviceFeatures[i].value != (AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY->items + iNPort)->sw.value){
-					SetSwitchValue(device, i, (AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY->items + iNPort)->sw.value);
-				}
-				iNPort++;
+			if((bool)deviceFeatures[switchSpan.feature[i]].value != switchSpan.item[i]->sw.value){
+				SetSwitchValue(device, switchSpan.feature[i], switchSpan.item[i]->sw.value);
 			}
 		}
 	}
@@ -1738,15 +3157,10 @@ static void aux_pwm_power_outlet_handler(indigo_device *device)
 	pthread_mutex_lock(&PRIVATE_DATA->mutex);
 	if (deviceFeatures)
 	{
-		int iNPort = 0;
-		for (size_t i = 0; i < portNum; i++)
+		for (int i = 0; i < pwmSpan.count; i++)
 		{
-			if (deviceFeatures[i].type == PWM)
-			{
-				if(deviceFeatures[i].value != (AUX_PWM_POWER_OUTLETS_PROPERTY->items + iNPort)->number.value){
-					SetSwitchValue(device, i, (AUX_PWM_POWER_OUTLETS_PROPERTY->items + iNPort)->number.value);
-				}
-				iNPort++;
+			if(deviceFeatures[pwmSpan.feature[i]].value != pwmSpan.item[i]->number.value){
+				SetSwitchValue(device, pwmSpan.feature[i], pwmSpan.item[i]->number.value);
 			}
 		}
 	}
@@ -1755,6 +3169,161 @@ static void aux_pwm_power_outlet_handler(indigo_device *device)
 	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
 }
 
+static void aux_fuse_handler(indigo_device *device)
+{
+	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	AUX_FUSE_PROPERTY->state = INDIGO_OK_STATE;
+	for (int i = 0; i < portNum; i++)
+	{
+		char command[30];
+		char response[50] = {0};
+
+		sprintf(command, ">I:%02d:%u:%u:%u#", i,
+			(unsigned int)(AUX_FUSE_PROPERTY->items + i * 3)->number.value,
+			(unsigned int)(AUX_FUSE_PROPERTY->items + i * 3 + 1)->number.value,
+			(unsigned int)(AUX_FUSE_PROPERTY->items + i * 3 + 2)->number.value);
+		if (!pbex_command(device, command, response, sizeof(response)) || strcmp(response, ">IOK#") != 0)
+		{
+			INDIGO_DRIVER_ERROR(DRIVER_NAME, "aux_fuse_handler Invalid response from device: %s", response);
+			AUX_FUSE_PROPERTY->state = INDIGO_ALERT_STATE;
+		}
+	}
+	indigo_update_property(device, AUX_FUSE_PROPERTY, NULL);
+	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
+}
+
+static void aux_budget_handler(indigo_device *device)
+{
+	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	if (SetParam(device, PARAM_BUDGET, (long)AUX_BUDGET_CURRENT_ITEM->number.value) &&
+		SetParam(device, PARAM_HEADROOM, (long)AUX_BUDGET_HEADROOM_ITEM->number.value))
+		AUX_BUDGET_PROPERTY->state = INDIGO_OK_STATE;
+	else
+		AUX_BUDGET_PROPERTY->state = INDIGO_ALERT_STATE;
+	indigo_update_property(device, AUX_BUDGET_PROPERTY, NULL);
+	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
+}
+
+static void aux_battery_handler(indigo_device *device)
+{
+	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	// the device refuses a restore level not above the cut or a full voltage not above the empty one,
+	// so a value refused only because the other one of its pair was still the old one is sent again
+	for (int pass = 0; pass < 2; pass++)
+	{
+		AUX_BATTERY_PROPERTY->state = INDIGO_OK_STATE;
+		for (int i = 0; i < AUX_BATTERY_PROPERTY->count; i++)
+		{
+			if (!SetParam(device, PARAM_LVDCUT + i, (long)(AUX_BATTERY_PROPERTY->items + i)->number.value))
+				AUX_BATTERY_PROPERTY->state = INDIGO_ALERT_STATE;
+		}
+		if (AUX_BATTERY_PROPERTY->state == INDIGO_OK_STATE)
+			break;
+	}
+	indigo_update_property(device, AUX_BATTERY_PROPERTY, NULL);
+	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
+}
+
+static void aux_pwm_timer_handler(indigo_device *device)
+{
+	char command[30];
+	char response[50] = {0};
+
+	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	AUX_PWM_TIMER_PROPERTY->state = INDIGO_OK_STATE;
+	if (!SetParam(device, PARAM_PWMPHASE, (long)AUX_PWM_STAGGER_ITEM->number.value))
+		AUX_PWM_TIMER_PROPERTY->state = INDIGO_ALERT_STATE;
+	sprintf(command, ">f:2:%d#", (int)AUX_PWM_TIMER2_CLOCK_ITEM->number.value);
+	if (!pbex_command(device, command, response, sizeof(response)) || strcmp(response, ">fOK#") != 0)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "aux_pwm_timer_handler Invalid response from device: %s", response);
+		AUX_PWM_TIMER_PROPERTY->state = INDIGO_ALERT_STATE;
+	}
+	sprintf(command, ">f:1:%d:%d#", (int)AUX_PWM_TIMER1_CLOCK_ITEM->number.value, (int)AUX_PWM_TIMER1_BITS_ITEM->number.value);
+	if (!pbex_command(device, command, response, sizeof(response)) || strcmp(response, ">fOK#") != 0)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "aux_pwm_timer_handler Invalid response from device: %s", response);
+		AUX_PWM_TIMER_PROPERTY->state = INDIGO_ALERT_STATE;
+	}
+	indigo_update_property(device, AUX_PWM_TIMER_PROPERTY, NULL);
+	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
+}
+
+static void aux_autotune_handler(indigo_device *device)
+{
+	char command[20];
+	char response[50] = {0};
+
+	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	if (AUX_AUTOTUNE_PORT_ITEM->number.value < 0)
+		strcpy(command, ">X#");
+	else
+		sprintf(command, ">X:%02d#", (int)AUX_AUTOTUNE_PORT_ITEM->number.value);
+	if (pbex_command(device, command, response, sizeof(response)) && strcmp(response, ">XOK#") == 0)
+	{
+		AUX_AUTOTUNE_PROPERTY->state = INDIGO_OK_STATE;
+		tuneState = -1;
+	}
+	else
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "aux_autotune_handler Invalid response from device: %s", response);
+		AUX_AUTOTUNE_PROPERTY->state = INDIGO_ALERT_STATE;
+	}
+	indigo_update_property(device, AUX_AUTOTUNE_PROPERTY, NULL);
+	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
+}
+
+static void aux_history_handler(indigo_device *device)
+{
+	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	if (SetParam(device, PARAM_HISTORY, (long)AUX_HISTORY_INTERVAL_ITEM->number.value))
+		AUX_HISTORY_PROPERTY->state = INDIGO_OK_STATE;
+	else
+		AUX_HISTORY_PROPERTY->state = INDIGO_ALERT_STATE;
+	indigo_update_property(device, AUX_HISTORY_PROPERTY, NULL);
+	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
+}
+
+static void aux_scope_handler(indigo_device *device)
+{
+	char command[50];
+	char response[50] = {0};
+
+	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	sprintf(command, ">c:%02d:%d:%ld:%d:%d#", (int)AUX_SCOPE_PORT_ITEM->number.value, (int)AUX_SCOPE_INPUTS_ITEM->number.value,
+		(long)AUX_SCOPE_TRIGGER_ITEM->number.value, (int)AUX_SCOPE_PRE_ITEM->number.value, (int)AUX_SCOPE_DECIMATE_ITEM->number.value);
+	// the property stays busy until UpdateScope() collects the capture
+	if (!pbex_command(device, command, response, sizeof(response)) || strcmp(response, ">cOK#") != 0)
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "aux_scope_handler Invalid response from device: %s", response);
+		AUX_SCOPE_PROPERTY->state = INDIGO_ALERT_STATE;
+	}
+	indigo_update_property(device, AUX_SCOPE_PROPERTY, NULL);
+	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
+}
+
+static void aux_timing_clear_handler(indigo_device *device)
+{
+	char response[50] = {0};
+
+	pthread_mutex_lock(&PRIVATE_DATA->mutex);
+	if (pbex_command(device, CLEARTIMING, response, sizeof(response)) && strcmp(response, ">tOK#") == 0)
+	{
+		AUX_TIMING_CLEAR_PROPERTY->state = INDIGO_OK_STATE;
+		gettimeofday(&PRIVATE_DATA->timing_stamp, NULL);
+		AUX_TIMING_PROPERTY->state = ReadTiming(device) ? INDIGO_OK_STATE : INDIGO_ALERT_STATE;
+		indigo_update_property(device, AUX_TIMING_PROPERTY, NULL);
+	}
+	else
+	{
+		INDIGO_DRIVER_ERROR(DRIVER_NAME, "aux_timing_clear_handler Invalid response from device: %s", response);
+		AUX_TIMING_CLEAR_PROPERTY->state = INDIGO_ALERT_STATE;
+	}
+	AUX_TIMING_CLEAR_ITEM->sw.value = false;
+	indigo_update_property(device, AUX_TIMING_CLEAR_PROPERTY, NULL);
+	pthread_mutex_unlock(&PRIVATE_DATA->mutex);
+}
+
 static indigo_result aux_change_property(indigo_device *device, indigo_client *client, indigo_property *property)
 {
 	assert(device != NULL);
@@ -1799,6 +3368,62 @@ static indigo_result aux_change_property(indigo_device *device, indigo_client *c
 		indigo_set_timer(device, 0, aux_pwm_configuration_handler, NULL);
 		return INDIGO_OK;
 	} 
+	else if (indigo_property_match_changeable(AUX_PWM_TIMER_PROPERTY, property)) {
+		indigo_property_copy_values(AUX_PWM_TIMER_PROPERTY, property, false);
+		AUX_PWM_TIMER_PROPERTY->state = INDIGO_BUSY_STATE;
+		indigo_update_property(device, AUX_PWM_TIMER_PROPERTY, NULL);
+		indigo_set_timer(device, 0, aux_pwm_timer_handler, NULL);
+		return INDIGO_OK;
+	}
+	else if (indigo_property_match_changeable(AUX_AUTOTUNE_PROPERTY, property)) {
+		indigo_property_copy_values(AUX_AUTOTUNE_PROPERTY, property, false);
+		AUX_AUTOTUNE_PROPERTY->state = INDIGO_BUSY_STATE;
+		indigo_update_property(device, AUX_AUTOTUNE_PROPERTY, NULL);
+		indigo_set_timer(device, 0, aux_autotune_handler, NULL);
+		return INDIGO_OK;
+	}
+	else if (indigo_property_match_changeable(AUX_HISTORY_PROPERTY, property)) {
+		indigo_property_copy_values(AUX_HISTORY_PROPERTY, property, false);
+		AUX_HISTORY_PROPERTY->state = INDIGO_BUSY_STATE;
+		indigo_update_property(device, AUX_HISTORY_PROPERTY, NULL);
+		indigo_set_timer(device, 0, aux_history_handler, NULL);
+		return INDIGO_OK;
+	}
+	else if (indigo_property_match_changeable(AUX_SCOPE_PROPERTY, property)) {
+		indigo_property_copy_values(AUX_SCOPE_PROPERTY, property, false);
+		AUX_SCOPE_PROPERTY->state = INDIGO_BUSY_STATE;
+		indigo_update_property(device, AUX_SCOPE_PROPERTY, NULL);
+		indigo_set_timer(device, 0, aux_scope_handler, NULL);
+		return INDIGO_OK;
+	}
+	else if (indigo_property_match_changeable(AUX_TIMING_CLEAR_PROPERTY, property)) {
+		indigo_property_copy_values(AUX_TIMING_CLEAR_PROPERTY, property, false);
+		AUX_TIMING_CLEAR_PROPERTY->state = INDIGO_BUSY_STATE;
+		indigo_update_property(device, AUX_TIMING_CLEAR_PROPERTY, NULL);
+		indigo_set_timer(device, 0, aux_timing_clear_handler, NULL);
+		return INDIGO_OK;
+	}
+	else if (indigo_property_match_changeable(AUX_BATTERY_PROPERTY, property)) {
+		indigo_property_copy_values(AUX_BATTERY_PROPERTY, property, false);
+		AUX_BATTERY_PROPERTY->state = INDIGO_BUSY_STATE;
+		indigo_update_property(device, AUX_BATTERY_PROPERTY, NULL);
+		indigo_set_timer(device, 0, aux_battery_handler, NULL);
+		return INDIGO_OK;
+	}
+	else if (indigo_property_match_changeable(AUX_BUDGET_PROPERTY, property)) {
+		indigo_property_copy_values(AUX_BUDGET_PROPERTY, property, false);
+		AUX_BUDGET_PROPERTY->state = INDIGO_BUSY_STATE;
+		indigo_update_property(device, AUX_BUDGET_PROPERTY, NULL);
+		indigo_set_timer(device, 0, aux_budget_handler, NULL);
+		return INDIGO_OK;
+	}
+	else if (indigo_property_match_changeable(AUX_FUSE_PROPERTY, property)) {
+		indigo_property_copy_values(AUX_FUSE_PROPERTY, property, false);
+		AUX_FUSE_PROPERTY->state = INDIGO_BUSY_STATE;
+		indigo_update_property(device, AUX_FUSE_PROPERTY, NULL);
+		indigo_set_timer(device, 0, aux_fuse_handler, NULL);
+		return INDIGO_OK;
+	}
 	else if (indigo_property_match_changeable(AUX_PWM_TEMP_OFFSETS_PROPERTY, property)) {
 		indigo_property_copy_values(AUX_PWM_TEMP_OFFSETS_PROPERTY, property, false);
 		AUX_PWM_TEMP_OFFSETS_PROPERTY->state = INDIGO_BUSY_STATE;
@@ -1808,47 +3433,23 @@ static indigo_result aux_change_property(indigo_device *device, indigo_client *c
 	}else if (indigo_property_match_changeable(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY, property)) {
 		indigo_property_copy_values(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY, property, false);
 
-		bool bIsPWMDefined = false;
-		bool bIsPWMSwitchDefined = false;
-
-		int nSW = 0;
-		int nPWM = 0;
-		int nAON = 0;
-		for(int i = 0; i < portNum; i++ ){
-
-			if(deviceFeatures[i].type == MPX){
-				snprintf((AUX_SWITCH_POWER_OUTLETS_PROPERTY->items + i)->label, 
-				INDIGO_VALUE_SIZE, "%s", (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value);
-			}
-
-			if(deviceFeatures[i].type == PWM){
-
-				bIsPWMDefined = true;
-				snprintf((AUX_PWM_POWER_OUTLETS_PROPERTY->items + nPWM)->label, 
-				INDIGO_VALUE_SIZE, "%s", (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value);
-				nPWM++;
-			}
-
-			if(deviceFeatures[i].type == SWH){
-				bIsPWMSwitchDefined = true;
-				snprintf((AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY->items + nSW)->label, INDIGO_VALUE_SIZE, 
-				"%s", (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value);
-				nSW++;
-			}
+		bool bIsPWMDefined = pwmSpan.count > 0;
+		bool bIsPWMSwitchDefined = switchSpan.count > 0;
+		FeatureSpan *ports[] = { &mpxSpan, &pwmSpan, &switchSpan, &aonSpan };
 
-			snprintf((AUX_CURRENT_SENSOR_PROPERTY->items + i)->label, 
-				INDIGO_VALUE_SIZE, "%s", (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value);
-			
-			for(int i = 0; i < portNum; i++){
-				sprintf((AUX_STATE_PROPERTY->items + i)->label,"%s",
-				(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value);
-			}
-			if(deviceFeatures[i].type == AON){
-				snprintf((AUX_ALWAYS_ON_PORTS_PROPERTY->items + nAON)->label, 
-				INDIGO_VALUE_SIZE, "%s", (AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value);
-				nAON++;
+		// the port features come first so their index is also the index of their name
+		for(int span = 0; span < sizeof(ports) / sizeof(ports[0]); span++){
+			for(int i = 0; i < ports[span]->count; i++){
+				snprintf(ports[span]->item[i]->label, INDIGO_VALUE_SIZE, "%s",
+				(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + ports[span]->feature[i])->text.value);
 			}
 		}
+		for(int i = 0; i < currentSpan.count; i++){
+			snprintf(currentSpan.item[i]->label, INDIGO_VALUE_SIZE, "%s",
+			(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value);
+			snprintf((AUX_STATE_PROPERTY->items + i)->label, INDIGO_VALUE_SIZE, "%s",
+			(AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->items + i)->text.value);
+		}
 		AUX_SWITCH_POWER_OUTLET_NAMES_PROPERTY->state = INDIGO_OK_STATE;
 		if (IS_CONNECTED) {
 
@@ -1895,15 +3496,8 @@ static indigo_result aux_detach(indigo_device *device)
 		aux_connection_handler(device);
 	}
 
-	indigo_release_property( AUX_SWITCH_POWER_OUTLETS_PROPERTY );
-	indigo_release_property( AUX_PWM_POWER_OUTLETS_PROPERTY );
-	indigo_release_property( AUX_PWM_MODES_PROPERTY );
-	indigo_release_property( AUX_PWM_TEMP_OFFSETS_PROPERTY );
-	indigo_release_property( AUX_PWM_SWITCH_POWER_OUTLETS_PROPERTY );
-	indigo_release_property( AUX_CURRENT_SENSOR_PROPERTY );
-	indigo_release_property( AUX_WEATHER_PROPERTY );
-	indigo_release_property( AUX_INFO_PROPERTY );
-	indigo_release_property( AUX_STATE_PROPERTY );
+	ReleaseLayout(device);
+	ReleaseSettings(device);
 	indigo_release_property( AUX_ALWAYS_ON_PORTS_PROPERTY );		
 	pthread_mutex_destroy(&PRIVATE_DATA->mutex);
 	INDIGO_DEVICE_DETACH_LOG(DRIVER_NAME, device->name);
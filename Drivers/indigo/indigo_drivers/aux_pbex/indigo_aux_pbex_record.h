@@ -0,0 +1,69 @@
+// Copyright (c) 2024
+// All rights reserved.
+//
+// You can use this software under the terms of 'INDIGO Astronomy
+// open-source license' (see LICENSE.md).
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHORS 'AS IS' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// version history
+// 1.0 by Rohan Salodkar <rohan5sep@gmail.com>
+
+/** PBEX status recorder file layout, shared by the driver and the export tool
+ \file indigo_aux_pbex_record.h
+ */
+
+#ifndef aux_pbex_record_h
+#define aux_pbex_record_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PBEX_RECORD_MAGIC "PBEXREC3"
+#define PBEX_RECORD_FIELDS 64		// values kept per record, the features past it are not recorded
+#define PBEX_RECORD_NAME 32			// column name length, longer feature names are truncated
+#define PBEX_RECORD_OFFSET 4096		// the records start on the page after the header
+
+// The file is the header then a ring of fixed size records in time order. A record holds only the <fields>
+// values used, so its size is PBEX_RECORD_SIZE(fields): the value of each feature of the board, the mean of the status
+// reads since the previous record for a measurement and the last read for a port state, mode or temperature offset,
+// then the peak of each current over the same reads, the one farthest from 0, in columns named '<feature> peak'.
+// <written> counts every record ever appended: the next one goes to slot written % capacity and the oldest kept
+// is written - capacity once the ring is full, so a reader can binary search a time range without scanning the file.
+// A record whose time is 0 is being written.
+typedef struct
+{
+	char magic[8];
+	uint32_t record_size;			// PBEX_RECORD_SIZE(fields)
+	uint32_t capacity;				// records in the ring
+	uint32_t fields;				// values used in each record
+	uint32_t reserved;
+	uint64_t written;
+	char signature[128];			// board signature the columns were built from
+	char names[PBEX_RECORD_FIELDS][PBEX_RECORD_NAME];
+} pbex_record_header;
+
+typedef struct
+{
+	double time;					// seconds since the epoch
+	float value[PBEX_RECORD_FIELDS];	// only the first <fields> are stored in the file
+} pbex_record;
+
+/// Bytes of a record of <fields> values in the file, a multiple of 8 so that every time stays aligned
+#define PBEX_RECORD_SIZE(fields) ((offsetof(pbex_record, value) + (fields) * sizeof(float) + 7) & ~(size_t)7)
+
+/// Record of the ring slot <n> counted from the start of the file
+#define PBEX_RECORD(header, n) ((pbex_record *)((char *)(header) + PBEX_RECORD_OFFSET + \
+	(size_t)((n) % (header)->capacity) * (header)->record_size))
+
+#endif /* aux_pbex_record_h */
@@ -0,0 +1,62 @@
+// Copyright (c) 2024
+// All rights reserved.
+//
+// You can use this software under the terms of 'INDIGO Astronomy
+// open-source license' (see LICENSE.md).
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHORS 'AS IS' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// version history
+// 1.0 by Rohan Salodkar <rohan5sep@gmail.com>
+
+/** PBEX latest status shared memory segment, shared by the driver and the reader library
+ \file indigo_aux_pbex_shm.h
+ */
+
+#ifndef aux_pbex_shm_h
+#define aux_pbex_shm_h
+
+#include <stdint.h>
+
+#include "indigo_aux_pbex_record.h"
+
+#define PBEX_SHM_NAME "/indigo_aux_pbex"
+#define PBEX_SHM_MAGIC "PBEXSHM1"
+
+// The driver is the only writer and guards every change with a seqlock: <sequence> is odd while it
+// writes, a reader copies what it needs and retries if the sequence was odd or moved meanwhile.
+// The layout, names included, is only rewritten when the driver connects to a device.
+typedef struct
+{
+	char magic[8];
+	uint32_t size;					// sizeof(pbex_shm_segment)
+	uint32_t sequence;
+	uint32_t fields;				// values used in <status>, 0 while no device is connected
+	uint32_t reserved;
+	char signature[128];			// board signature the columns were built from
+	char names[PBEX_RECORD_FIELDS][PBEX_RECORD_NAME];
+	pbex_record status;				// latest status read, its time is 0 until the first one
+} pbex_shm_segment;
+
+static inline void pbex_shm_write_begin(pbex_shm_segment *segment)
+{
+	__atomic_store_n(&segment->sequence, segment->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void pbex_shm_write_end(pbex_shm_segment *segment)
+{
+	__atomic_store_n(&segment->sequence, segment->sequence + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* aux_pbex_shm_h */
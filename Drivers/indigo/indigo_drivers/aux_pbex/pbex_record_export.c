@@ -0,0 +1,148 @@
+// Copyright (c) 2024
+// All rights reserved.
+//
+// You can use this software under the terms of 'INDIGO Astronomy
+// open-source license' (see LICENSE.md).
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHORS 'AS IS' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// version history
+// 1.0 by Rohan Salodkar <rohan5sep@gmail.com>
+
+/** PBEX status recorder export to CSV
+ \file pbex_record_export.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "indigo_aux_pbex_record.h"
+
+/// Seconds since the epoch from 'YYYY-MM-DD[ HH:MM[:SS]]' in local time or a plain number of seconds
+static int parse_time(const char *text, double *value)
+{
+	struct tm tm;
+	char *end;
+
+	*value = strtod(text, &end);
+	if (*end == '\0')
+		return 1;
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 3)
+		return 0;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+	*value = mktime(&tm);
+	return 1;
+}
+
+/// First of the <count> records after <first> whose time is not before <from>, the records are in time order
+static uint64_t find_record(pbex_record_header *header, uint64_t first, uint64_t count, double from)
+{
+	uint64_t low = first;
+	uint64_t high = first + count;
+
+	while (low < high)
+	{
+		uint64_t middle = low + (high - low) / 2;
+
+		if (PBEX_RECORD(header, middle)->time < from)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+int main(int argc, const char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : NULL;
+	char home[256];
+	double from = 0;
+	double to = 1e12;
+	struct stat info;
+	pbex_record_header *header;
+	uint64_t written, first, count;
+	double last = 0;
+	int handle;
+
+	if (argc > 4 || (argc > 2 && !parse_time(argv[2], &from)) || (argc > 3 && !parse_time(argv[3], &to)))
+	{
+		fprintf(stderr, "usage: %s [record file] [from] [to]\n", argv[0]);
+		fprintf(stderr, "  exports the records from <from> to <to> as CSV, the times are 'YYYY-MM-DD HH:MM:SS' or seconds since the epoch\n");
+		fprintf(stderr, "  the record file defaults to ~/.indigo/aux_pbex.record\n");
+		return 1;
+	}
+	if (path == NULL || strcmp(path, "-") == 0)
+	{
+		snprintf(home, sizeof(home), "%s/.indigo/aux_pbex.record", getenv("HOME") != NULL ? getenv("HOME") : ".");
+		path = home;
+	}
+	if ((handle = open(path, O_RDONLY)) < 0 || fstat(handle, &info) < 0)
+	{
+		perror(path);
+		return 1;
+	}
+	header = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, handle, 0);
+	close(handle);
+	if (header == MAP_FAILED || info.st_size < PBEX_RECORD_OFFSET ||
+		memcmp(header->magic, PBEX_RECORD_MAGIC, sizeof(header->magic)) != 0 || header->fields > PBEX_RECORD_FIELDS ||
+		header->record_size != PBEX_RECORD_SIZE(header->fields) || header->capacity == 0 ||
+		(uint64_t)info.st_size < PBEX_RECORD_OFFSET + (uint64_t)header->capacity * header->record_size)
+	{
+		fprintf(stderr, "%s: not a record file\n", path);
+		return 1;
+	}
+
+	// the driver may be appending: the slot of the next record is the oldest one once the ring is full, leave it out
+	written = header->written;
+	count = written < header->capacity ? written : header->capacity - 1;
+	first = written - count;
+
+	printf("time");
+	for (uint32_t f = 0; f < header->fields; f++)
+		printf(",%s", header->names[f]);
+	printf("\n");
+	for (uint64_t n = find_record(header, first, count, from); n < written; n++)
+	{
+		pbex_record *record = PBEX_RECORD(header, n);
+		float value[PBEX_RECORD_FIELDS];
+		double time = record->time;
+
+		if (time > to)
+			break;
+		// skip a record being written, or overwritten when the driver lapped a slow export
+		if (time <= last)
+			continue;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		memcpy(value, record->value, header->fields * sizeof(float));
+		// the driver clears the time before it rewrites the slot, a time that moved while copying is a torn record
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (record->time != time)
+			continue;
+		printf("%.1f", time);
+		for (uint32_t f = 0; f < header->fields; f++)
+			printf(",%g", value[f]);
+		printf("\n");
+		last = time;
+	}
+	munmap(header, info.st_size);
+	return 0;
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2024
+// All rights reserved.
+//
+// You can use this software under the terms of 'INDIGO Astronomy
+// open-source license' (see LICENSE.md).
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHORS 'AS IS' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// version history
+// 1.0 by Rohan Salodkar <rohan5sep@gmail.com>
+
+/** PBEX latest status reader library
+ \file pbex_shm.c
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "pbex_shm.h"
+
+const pbex_shm_segment *pbex_shm_open(const char *name)
+{
+	pbex_shm_segment *segment;
+	int handle = shm_open(name != NULL ? name : PBEX_SHM_NAME, O_RDONLY, 0);
+
+	if (handle < 0)
+		return NULL;
+	segment = mmap(NULL, sizeof(pbex_shm_segment), PROT_READ, MAP_SHARED, handle, 0);
+	close(handle);
+	if (segment == MAP_FAILED)
+		return NULL;
+	if (memcmp(segment->magic, PBEX_SHM_MAGIC, sizeof(segment->magic)) != 0 || segment->size != sizeof(pbex_shm_segment))
+	{
+		munmap(segment, sizeof(pbex_shm_segment));
+		return NULL;
+	}
+	return segment;
+}
+
+void pbex_shm_close(const pbex_shm_segment *segment)
+{
+	if (segment != NULL)
+		munmap((void *)segment, sizeof(pbex_shm_segment));
+}
+
+/// Copies <size> bytes at <data> under the seqlock, with the number of values published with them,
+/// past PBEX_SHM_SPINS races it lets the driver run, and gives up after PBEX_SHM_RETRIES as a driver that died
+/// while it wrote leaves the sequence odd
+static int pbex_shm_copy(const pbex_shm_segment *segment, void *copy, const void *data, size_t size, unsigned *retries)
+{
+	unsigned raced = 0;
+	uint32_t sequence;
+	uint32_t fields;
+
+	for (;;)
+	{
+		if (raced == PBEX_SHM_RETRIES)
+		{
+			if (retries != NULL)
+				*retries = raced;
+			errno = EAGAIN;
+			return -1;
+		}
+		sequence = __atomic_load_n(&segment->sequence, __ATOMIC_ACQUIRE);
+		if (!(sequence & 1))
+		{
+			fields = segment->fields;
+			memcpy(copy, data, size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&segment->sequence, __ATOMIC_RELAXED) == sequence)
+				break;
+		}
+		if (++raced > PBEX_SHM_SPINS)
+			sched_yield();
+	}
+	if (retries != NULL)
+		*retries = raced;
+	return fields <= PBEX_RECORD_FIELDS ? fields : PBEX_RECORD_FIELDS;
+}
+
+int pbex_shm_read(const pbex_shm_segment *segment, pbex_record *snapshot, unsigned *retries)
+{
+	return pbex_shm_copy(segment, snapshot, &segment->status, sizeof(pbex_record), retries);
+}
+
+int pbex_shm_names(const pbex_shm_segment *segment, char names[][PBEX_RECORD_NAME])
+{
+	return pbex_shm_copy(segment, names, segment->names, sizeof(segment->names), NULL);
+}
+
+int pbex_shm_find(const pbex_shm_segment *segment, const char *name)
+{
+	char names[PBEX_RECORD_FIELDS][PBEX_RECORD_NAME];
+	int fields = pbex_shm_names(segment, names);
+
+	for (int f = 0; f < fields; f++)
+		if (strcmp(names[f], name) == 0)
+			return f;
+	return -1;
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2024
+// All rights reserved.
+//
+// You can use this software under the terms of 'INDIGO Astronomy
+// open-source license' (see LICENSE.md).
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHORS 'AS IS' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// version history
+// 1.0 by Rohan Salodkar <rohan5sep@gmail.com>
+
+/** PBEX latest status reader library, for processes on the same host as the driver
+ \file pbex_shm.h
+ */
+
+#ifndef pbex_shm_h
+#define pbex_shm_h
+
+#include "indigo_aux_pbex_shm.h"
+
+#define PBEX_SHM_SPINS 1000			// races a copy spins through before it yields the CPU to the driver
+#define PBEX_SHM_RETRIES 100000		// races before a copy gives up, some tens of ms as it yields on most of them
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Map the segment read-only, NULL for the driver's PBEX_SHM_NAME, returns NULL if the driver never published it
+ */
+extern const pbex_shm_segment *pbex_shm_open(const char *name);
+
+/** Unmap the segment
+ */
+extern void pbex_shm_close(const pbex_shm_segment *segment);
+
+/** Copy a consistent snapshot of the latest status, returns the number of values or 0 while no device is connected,
+ <retries>, if not NULL, is the number of times the copy raced the driver. Returns -1 with errno EAGAIN after
+ PBEX_SHM_RETRIES races, when the driver was stopped or died in the middle of a write
+ */
+extern int pbex_shm_read(const pbex_shm_segment *segment, pbex_record *snapshot, unsigned *retries);
+
+/** Copy the column names, returns the number of columns or -1 with errno EAGAIN like pbex_shm_read()
+ */
+extern int pbex_shm_names(const pbex_shm_segment *segment, char names[][PBEX_RECORD_NAME]);
+
+/** Column of the value named <name>, -1 if there is none or the names could not be copied
+ */
+extern int pbex_shm_find(const pbex_shm_segment *segment, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* pbex_shm_h */
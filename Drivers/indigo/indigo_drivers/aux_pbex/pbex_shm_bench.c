@@ -0,0 +1,157 @@
+// Copyright (c) 2024
+// All rights reserved.
+//
+// You can use this software under the terms of 'INDIGO Astronomy
+// open-source license' (see LICENSE.md).
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHORS 'AS IS' AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// version history
+// 1.0 by Rohan Salodkar <rohan5sep@gmail.com>
+
+/** PBEX latest status reader benchmark
+ \file pbex_shm_bench.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "pbex_shm.h"
+
+#define BENCH_SHM_NAME "/pbex_shm_bench"
+
+static volatile int running = 1;
+
+static double now(void)
+{
+	struct timespec stamp;
+
+	clock_gettime(CLOCK_MONOTONIC, &stamp);
+	return stamp.tv_sec + stamp.tv_nsec / 1e9;
+}
+
+/// Publishes as fast as it can, every value of a status equal to its time, so that a torn snapshot shows
+static void *bench_writer(void *arg)
+{
+	pbex_shm_segment *segment = arg;
+	double count = 0;
+
+	while (running)
+	{
+		count++;
+		pbex_shm_write_begin(segment);
+		segment->status.time = count;
+		for (int f = 0; f < PBEX_RECORD_FIELDS; f++)
+			segment->status.value[f] = (float)count;
+		pbex_shm_write_end(segment);
+	}
+	return NULL;
+}
+
+/// Creates the benchmark segment the way the driver creates its own
+static pbex_shm_segment *bench_segment(void)
+{
+	pbex_shm_segment *segment;
+	int handle = shm_open(BENCH_SHM_NAME, O_RDWR | O_CREAT, 0600);
+
+	if (handle < 0 || ftruncate(handle, sizeof(pbex_shm_segment)) < 0)
+		return NULL;
+	segment = mmap(NULL, sizeof(pbex_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	close(handle);
+	if (segment == MAP_FAILED)
+		return NULL;
+	memset(segment, 0, sizeof(pbex_shm_segment));
+	segment->size = sizeof(pbex_shm_segment);
+	segment->fields = PBEX_RECORD_FIELDS;
+	memcpy(segment->magic, PBEX_SHM_MAGIC, sizeof(segment->magic));
+	return segment;
+}
+
+int main(int argc, const char *argv[])
+{
+	int contended = argc > 1 && strcmp(argv[1], "-w") == 0;
+	long reads = argc > 1 + contended ? atol(argv[1 + contended]) : 10000000;
+	const pbex_shm_segment *segment;
+	pbex_shm_segment *bench = NULL;
+	pthread_t writer;
+	pbex_record snapshot;
+	unsigned long long raced = 0;
+	long torn = 0;
+	long failed = 0;
+	long fields = 0;
+	double start, elapsed;
+
+	if (reads <= 0 || argc > 2 + contended)
+	{
+		fprintf(stderr, "usage: %s [-w] [reads]\n", argv[0]);
+		fprintf(stderr, "  times <reads> snapshots of the driver segment, with -w of a test segment written without pause by another thread\n");
+		return 1;
+	}
+	if (contended)
+	{
+		if ((bench = bench_segment()) == NULL)
+		{
+			perror(BENCH_SHM_NAME);
+			return 1;
+		}
+		pthread_create(&writer, NULL, bench_writer, bench);
+	}
+	if ((segment = pbex_shm_open(contended ? BENCH_SHM_NAME : NULL)) == NULL)
+	{
+		fprintf(stderr, "%s: no segment, is the driver running?\n", contended ? BENCH_SHM_NAME : PBEX_SHM_NAME);
+		return 1;
+	}
+
+	start = now();
+	for (long n = 0; n < reads; n++)
+	{
+		unsigned retries;
+		int count = pbex_shm_read(segment, &snapshot, &retries);
+
+		raced += retries;
+		if (count < 0)
+		{
+			failed++;
+			continue;
+		}
+		fields += count;
+		// the time and the values of a snapshot are rounded to float the same way
+		for (int f = 0; contended && f < count; f++)
+			if (snapshot.value[f] != (float)snapshot.time)
+			{
+				torn++;
+				break;
+			}
+	}
+	elapsed = now() - start;
+
+	if (contended)
+	{
+		running = 0;
+		pthread_join(writer, NULL);
+		shm_unlink(BENCH_SHM_NAME);
+	}
+	printf("%ld snapshots of %ld values in %.3fs: %.1f ns each, %.0f per second\n", reads, fields / reads, elapsed,
+		elapsed * 1e9 / reads, reads / elapsed);
+	printf("%llu retries (%.3f per snapshot), %ld torn snapshots, %ld given up\n", raced, (double)raced / reads, torn, failed);
+	pbex_shm_close(segment);
+	if (bench != NULL)
+		munmap(bench, sizeof(pbex_shm_segment));
+	return torn != 0;
+}